@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "convfont.h"
+#include "appvar.h"
+
+/* A .8xv file is a signature, a comment, and the length of the data section;
+ * then the data section, which holds one variable entry; then a checksum of
+ * the data section. */
+#define FILE_HEADER_SIZE 55
+#define COMMENT_OFFSET 11
+#define COMMENT_SIZE 42
+#define ENTRY_HEADER_SIZE 17
+#define CHECKSUM_SIZE 2
+#define APPVAR_TYPE 0x15
+#define ARCHIVED_FLAG 0x80
+
+static const char file_signature[COMMENT_OFFSET] = "**TI83F*\x1A\x0A";
+
+static const char comment[] = "Created by convfont";
+
+static uint8_t *put_word(uint8_t *dest, unsigned int data) {
+    *dest++ = (uint8_t)(data & 255);
+    *dest++ = (uint8_t)((data >> 8) & 255);
+    return dest;
+}
+
+void check_appvar_name(const char *name) {
+    size_t length = strlen(name);
+    if (length < 1 || length > MAX_APPVAR_NAME_LENGTH)
+        throw_errorf(bad_options, "Appvar name \"%s\" must be 1 to %i characters long.", name, MAX_APPVAR_NAME_LENGTH);
+    if (!isalpha((unsigned char)name[0]))
+        throw_errorf(bad_options, "Appvar name \"%s\" must start with a letter.", name);
+    for (size_t i = 1; i < length; i++)
+        if (!isalnum((unsigned char)name[i]))
+            throw_errorf(bad_options, "Appvar name \"%s\" may only contain letters and digits.", name);
+}
+
+uint8_t *build_appvar_file(const uint8_t *data, size_t size, const char *name, bool archived, size_t *file_size) {
+    check_appvar_name(name);
+    /* The variable's data starts with its own length, and the entry and the
+     * data section both have 16-bit lengths. */
+    size_t section_size = ENTRY_HEADER_SIZE + 2 + size;
+    if (section_size > 0xFFFF)
+        throw_error(bad_options, "Cannot form appvar; output appvar size would exceed 64 K appvar size limit.");
+    *file_size = FILE_HEADER_SIZE + section_size + CHECKSUM_SIZE;
+    uint8_t *file = calloc(1, *file_size);
+    if (file == NULL)
+        throw_error(malloc_failed, "build_appvar_file: failed to malloc file");
+    /* File header */
+    memcpy(file, file_signature, COMMENT_OFFSET);
+    memcpy(file + COMMENT_OFFSET, comment, sizeof(comment));
+    uint8_t *dest = put_word(file + COMMENT_OFFSET + COMMENT_SIZE, (unsigned int)section_size);
+    /* Variable entry */
+    uint8_t *section = dest;
+    dest = put_word(dest, 0x0D);
+    dest = put_word(dest, (unsigned int)(size + 2));
+    *dest++ = APPVAR_TYPE;
+    memcpy(dest, name, strlen(name));
+    dest += MAX_APPVAR_NAME_LENGTH;
+    *dest++ = 0;
+    *dest++ = archived ? ARCHIVED_FLAG : 0;
+    dest = put_word(dest, (unsigned int)(size + 2));
+    /* Variable data */
+    dest = put_word(dest, (unsigned int)size);
+    memcpy(dest, data, size);
+    dest += size;
+    /* The checksum is just the low 16 bits of the sum of the data section. */
+    unsigned int checksum = 0;
+    for (uint8_t *p = section; p < dest; p++)
+        checksum += *p;
+    put_word(dest, checksum);
+    return file;
+}
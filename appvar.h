@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* Longest name a TI-84 Plus CE variable can have. */
+#define MAX_APPVAR_NAME_LENGTH 8
+
+/* Throws if name can't be used as an appvar's name: it must be one to eight
+ * letters and digits, starting with a letter.
+ * @param name The name to check. */
+void check_appvar_name(const char *name);
+
+/* Wraps data in a .8xv file, which can be sent straight to a calculator,
+ * without needing convhex.
+ * @param data The appvar's contents.
+ * @param size Size of data in bytes.
+ * @param name The appvar's name; see check_appvar_name().
+ * @param archived Whether the appvar should be sent to archive.
+ * @param file_size Receives the size of the file.
+ * @return A malloc()ed buffer holding the file, which the caller must free(). */
+uint8_t *build_appvar_file(const uint8_t *data, size_t size, const char *name, bool archived, size_t *file_size);
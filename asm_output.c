@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "convfont.h"
+#include "image.h"
+#include "pack_bitmaps.h"
+#include "asm_output.h"
+
+/* Output is collected here and written in chunks of about this size. */
+#define ASM_BUFFER_SIZE 16384
+
+/* Longest line the writer has to hold, newline included.  Real lines are
+ * well under this. */
+#define MAX_LINE_LENGTH 128
+
+/* Most characters put on one line of a string, which keeps even a line of
+ * numbers well inside MAX_LINE_LENGTH. */
+#define STRING_LINE_LENGTH 16
+
+/* Every byte written out in binary, eight digits each. */
+#define BITS1(p) p "0" p "1"
+#define BITS2(p) BITS1(p "0") BITS1(p "1")
+#define BITS3(p) BITS2(p "0") BITS2(p "1")
+#define BITS4(p) BITS3(p "0") BITS3(p "1")
+#define BITS5(p) BITS4(p "0") BITS4(p "1")
+#define BITS6(p) BITS5(p "0") BITS5(p "1")
+#define BITS7(p) BITS6(p "0") BITS6(p "1")
+#define BITS8(p) BITS7(p "0") BITS7(p "1")
+static const char binary_digits[] = BITS8("");
+#undef BITS1
+#undef BITS2
+#undef BITS3
+#undef BITS4
+#undef BITS5
+#undef BITS6
+#undef BITS7
+#undef BITS8
+
+/* The directive for a bitmap row, by its number of byte columns. */
+static const char *const row_directives[4] = { NULL, "\tdb\t", "\tdw\t", "\tdl\t" };
+
+typedef struct {
+    FILE *file;
+    bool unix_newline_style;
+    size_t length;
+    char buffer[ASM_BUFFER_SIZE];
+} asm_writer_t;
+
+static void flush_writer(asm_writer_t *writer) {
+    fwrite(writer->buffer, 1, writer->length, writer->file);
+    writer->length = 0;
+}
+
+/* Makes room for a line and returns where it goes. */
+static char *start_line(asm_writer_t *writer) {
+    if (writer->length > ASM_BUFFER_SIZE - MAX_LINE_LENGTH)
+        flush_writer(writer);
+    return writer->buffer + writer->length;
+}
+
+/* Finishes a line started with start_line() whose text ends at end. */
+static void end_line(asm_writer_t *writer, char *end) {
+    if (!writer->unix_newline_style)
+        *end++ = '\r';
+    *end++ = '\n';
+    writer->length = (size_t)(end - writer->buffer);
+}
+
+static void put_line(asm_writer_t *writer, const char *format, ...) {
+    va_list args;
+    char *line = start_line(writer);
+    va_start(args, format);
+    int length = vsnprintf(line, MAX_LINE_LENGTH - 2, format, args);
+    va_end(args);
+    if (length < 0 || length >= MAX_LINE_LENGTH - 2)
+        throw_error(internal_error, "write_asm: Line too long.");
+    end_line(writer, line + length);
+}
+
+/* Writes a string as db lines, with its terminating NUL.  Printable
+ * characters are quoted, and anything an assembler might trip over is written
+ * as a number. */
+static void put_string(asm_writer_t *writer, const char *string) {
+    const unsigned char *c = (const unsigned char *)string;
+    char *p = NULL;
+    int count = 0;
+    bool quoted = false;
+    do {
+        if (count == 0) {
+            p = start_line(writer);
+            memcpy(p, "\tdb\t", 4);
+            p += 4;
+        }
+        if (*c >= ' ' && *c < 0x7F && *c != '"' && *c != '\\') {
+            if (!quoted) {
+                if (count > 0) {
+                    *p++ = ',';
+                    *p++ = ' ';
+                }
+                *p++ = '"';
+                quoted = true;
+            }
+            *p++ = (char)*c;
+        } else {
+            if (quoted) {
+                *p++ = '"';
+                quoted = false;
+            }
+            if (count > 0) {
+                *p++ = ',';
+                *p++ = ' ';
+            }
+            p += sprintf(p, "%i", *c);
+        }
+        if (*c == '\0' || ++count == STRING_LINE_LENGTH) {
+            if (quoted) {
+                *p++ = '"';
+                quoted = false;
+            }
+            end_line(writer, p);
+            count = 0;
+        }
+    } while (*c++ != '\0');
+}
+
+/* Writes one font.  Every label starts with prefix, so that several fonts can
+ * go in one file.
+ * @param first Output of find_shared_bitmaps(), or each glyph's own index if
+ * bitmaps aren't shared. */
+static void put_font(asm_writer_t *writer, fontlib_font_t *font, const char *prefix, const int first[256]) {
+    put_line(writer, ".%sheader:", prefix);
+    put_line(writer, "\tdb\t0 ; font format version");
+    put_line(writer, "\tdb\t%i ; height", font->height);
+    put_line(writer, "\tdb\t%i ; glyph count", font->total_glyphs & 0xFF);
+    put_line(writer, "\tdb\t%i ; first glyph", font->first_glyph);
+    put_line(writer, "\tdl\t.%swidthsTable - .%sheader ; offset to widths table", prefix, prefix);
+    put_line(writer, "\tdl\t.%sbitmapsTable - .%sheader ; offset to bitmaps offsets table", prefix, prefix);
+    put_line(writer, "\tdb\t%i ; italics space adjust", font->italic_space_adjust);
+    put_line(writer, "\tdb\t%i ; suggested blank space above", font->space_above);
+    put_line(writer, "\tdb\t%i ; suggested blank space below", font->space_below);
+    put_line(writer, "\tdb\t%i ; weight (boldness/thinness)", font->weight);
+    put_line(writer, "\tdb\t%i ; style field", font->style);
+    put_line(writer, "\tdb\t%i ; capital height", font->cap_height);
+    put_line(writer, "\tdb\t%i ; lowercase x height", font->x_height);
+    put_line(writer, "\tdb\t%i ; baseline height", font->baseline_height);
+    put_line(writer, ".%swidthsTable: ; start of widths table", prefix);
+    for (int i = 0; i < font->total_glyphs; i++)
+        put_line(writer, "\tdb\t%i ; Code point $%02X %c", font->widths_table[i], i + font->first_glyph, i + font->first_glyph);
+    put_line(writer, ".%sbitmapsTable: ; start of table of offsets to bitmaps", prefix);
+    for (int i = 0; i < font->total_glyphs; i++) {
+        int width = font->widths_table[i];
+        if (width <= 16)
+            put_line(writer, "\tdw\t.%sglyph_%02X - .%sheader - %i; %c", prefix, first[i] + font->first_glyph, prefix, 3 - byte_columns(width), i + font->first_glyph);
+        else
+            put_line(writer, "\tdw\t.%sglyph_%02X - .%sheader; %c", prefix, first[i] + font->first_glyph, prefix, i + font->first_glyph);
+    }
+    for (int i = 0; i < font->total_glyphs; i++) {
+        /* Glyphs with a twin just point at its bitmap. */
+        if (first[i] != i)
+            continue;
+        int columns = byte_columns(font->widths_table[i]);
+        if (columns < 1 || columns > 3)
+            throw_error(internal_error, "byte_columns failed to give 1, 2, or 3.  That should not happen.");
+        put_line(writer, ".%sglyph_%02X: ; %c", prefix, i + font->first_glyph, i + font->first_glyph);
+        /* The format requires omitting the least-significant byte(s) if
+         * they're unused, which is just what the directive for the number of
+         * columns does. */
+        const uint8_t *bytes = font->bitmaps[i]->bytes;
+        for (int row = 0; row < font->height; row++) {
+            char *p = start_line(writer);
+            memcpy(p, row_directives[columns], 4);
+            p += 4;
+            for (int col = 0; col < columns; col++, p += 8)
+                memcpy(p, binary_digits + 8 * *bytes++, 8);
+            *p++ = 'b';
+            end_line(writer, p);
+        }
+    }
+}
+
+/* Decides which glyphs share bitmaps.
+ * @return The number of bytes the font assembles to. */
+static size_t plan_font(fontlib_font_t *font, bitmap_packing_t packing, int first[256]) {
+    int size = find_shared_bitmaps(font, first);
+    if (packing == packing_none) {
+        size = 0;
+        for (int i = 0; i < font->total_glyphs; i++) {
+            first[i] = i;
+            size += font->bitmaps[i]->length;
+        }
+    }
+    return (size_t)(18 + 3 * font->total_glyphs + size);
+}
+
+size_t write_asm_font(FILE *file, fontlib_font_t *font, bitmap_packing_t packing, bool unix_newline_style) {
+    int first[256];
+    size_t size = 0;
+    asm_writer_t *writer = malloc(sizeof(asm_writer_t));
+    if (writer == NULL)
+        throw_error(malloc_failed, "write_asm_font: failed to malloc output buffer");
+    writer->file = file;
+    writer->unix_newline_style = unix_newline_style;
+    writer->length = 0;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        size = plan_font(font, packing, first);
+        put_font(writer, font, "", first);
+        flush_writer(writer);
+        pop_error_trap(&trap);
+    } else {
+        free(writer);
+        rethrow_error(&trap);
+    }
+    free(writer);
+    return size;
+}
+
+/* Does the actual work of write_asm_fontpack().
+ * @param firsts Room for count arrays of which glyphs share bitmaps.
+ * @return The number of bytes the font pack assembles to. */
+static size_t put_fontpack(asm_writer_t *writer, fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, int (*firsts)[256]) {
+    /* Metadata strings in storage order, with the labels they get. */
+    const char *strings[FONTPACK_METADATA_STRINGS] = {
+        metadata->name, metadata->author, metadata->pseudocopyright,
+        metadata->description, metadata->version, metadata->codepage
+    };
+    static const char *const string_names[FONTPACK_METADATA_STRINGS] = {
+        "name", "author", "pseudocopyright", "description", "version", "codepage"
+    };
+    bool has_metadata = false;
+    size_t size = 12 + 3 * count;
+    for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+        if (strings[i] != NULL) {
+            if (!has_metadata)
+                size += MEATADATA_STRUCT_SIZE;
+            has_metadata = true;
+            size += strlen(strings[i]) + 1;
+        }
+    /* Bitmaps are only shared within each font, since every font's offsets
+     * are relative to its own header. */
+    for (int f = 0; f < count; f++)
+        size += plan_font(fonts[f], packing, firsts[f]);
+    if (size >= MAX_APPVAR_SIZE)
+        throw_error(bad_options, "Cannot form appvar; output appvar size would exceed 64 K appvar size limit.");
+    put_line(writer, ".fontpack:");
+    put_line(writer, "\tdb\t\"FONTPACK\"");
+    if (has_metadata)
+        put_line(writer, "\tdl\t.metadata - .fontpack ; offset to metadata");
+    else
+        put_line(writer, "\tdl\t0 ; no metadata");
+    put_line(writer, "\tdb\t%i ; font count", count);
+    for (int f = 0; f < count; f++)
+        put_line(writer, "\tdl\t.font%i_header - .fontpack ; offset to font %i", f + 1, f + 1);
+    if (has_metadata) {
+        put_line(writer, ".metadata:");
+        put_line(writer, "\tdl\t%i ; metadata struct size", MEATADATA_STRUCT_SIZE);
+        for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+            if (strings[i] != NULL)
+                put_line(writer, "\tdl\t.metadata_%s - .fontpack ; offset to %s", string_names[i], string_names[i]);
+            else
+                put_line(writer, "\tdl\t0 ; no %s", string_names[i]);
+        for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+            if (strings[i] != NULL) {
+                put_line(writer, ".metadata_%s:", string_names[i]);
+                put_string(writer, strings[i]);
+            }
+    }
+    for (int f = 0; f < count; f++) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "font%i_", f + 1);
+        put_font(writer, fonts[f], prefix, firsts[f]);
+    }
+    flush_writer(writer);
+    return size;
+}
+
+size_t write_asm_fontpack(FILE *file, fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, bool unix_newline_style) {
+    if (count < 1 || count > 255)
+        throw_error(bad_options, "Font pack must contain between 1 and 255 fonts.");
+    int (*firsts)[256] = malloc(count * sizeof(*firsts));
+    asm_writer_t *writer = malloc(sizeof(asm_writer_t));
+    if (firsts == NULL || writer == NULL) {
+        free(firsts);
+        free(writer);
+        throw_error(malloc_failed, "write_asm_fontpack: failed to malloc output buffer");
+    }
+    writer->file = file;
+    writer->unix_newline_style = unix_newline_style;
+    writer->length = 0;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        size_t size = put_fontpack(writer, fonts, count, metadata, packing, firsts);
+        pop_error_trap(&trap);
+        free(firsts);
+        free(writer);
+        return size;
+    }
+    free(firsts);
+    free(writer);
+    rethrow_error(&trap);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "image.h"
+#include "pack_bitmaps.h"
+
+/* Writes a font as assembly source, for -o asmarray.  Bitmaps are written in
+ * binary, one row per line, with a label for each, so the assembler works out
+ * the offsets.  Labels can't overlap, so packing never goes further than
+ * sharing identical bitmaps.
+ * @param file Where to write the source.
+ * @param font The font to write.
+ * @param packing How glyph bitmaps are laid out.
+ * @param unix_newline_style false to use CR+LF newlines.
+ * @return The number of bytes the font assembles to. */
+size_t write_asm_font(FILE *file, fontlib_font_t *font, bitmap_packing_t packing, bool unix_newline_style);
+
+/* Writes a font pack as assembly source, for -o asmfontpack.  Each font is
+ * written as write_asm_font() would, with its labels prefixed so they don't
+ * clash.  Throws if the pack wouldn't fit in an appvar.
+ * @param file Where to write the source.
+ * @param fonts The fonts to pack.
+ * @param count Number of fonts.
+ * @param metadata Strings describing the pack.
+ * @param packing How glyph bitmaps are laid out.
+ * @param unix_newline_style false to use CR+LF newlines.
+ * @return The number of bytes the pack assembles to. */
+size_t write_asm_fontpack(FILE *file, fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, bool unix_newline_style);
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "convfont.h"
+#include "batch.h"
+#include "file_buffer.h"
+#include "job.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4996)
+#define claim_next(P) (InterlockedIncrement((volatile LONG *)(P)) - 1)
+#else
+#define claim_next(P) __atomic_fetch_add((P), 1, __ATOMIC_RELAXED)
+#endif
+
+/* One line of the manifest. */
+typedef struct {
+    int line;
+    int argc;
+    char **argv;
+    conversion_job_t job;
+    /* Zero if the job hasn't failed, otherwise the error code. */
+    int code;
+    char message[256];
+} batch_entry_t;
+
+/* A contiguous run of jobs.  Each worker starts on its own slice, then helps
+ * itself to whatever is left in the others' slices. */
+typedef struct {
+    volatile long next;
+    long end;
+} work_slice_t;
+
+typedef struct {
+    batch_entry_t **runnable;
+    work_slice_t *slices;
+    int slice_count;
+} batch_t;
+
+typedef struct {
+    batch_t *batch;
+    int id;
+} worker_t;
+
+
+/*******************************************************************************
+*                                  MANIFEST                                    *
+*******************************************************************************/
+
+/* Splits one line of a manifest into arguments.  This is done in place, so
+ * the arguments point into line.
+ * @param line The line, which must be NUL-terminated and will be modified.
+ * @param args Receives the arguments; must have room for (strlen(line) + 1) / 2.
+ * @return Number of arguments found. */
+static int split_line(char *line, char **args) {
+    int count = 0;
+    char *in = line;
+    for (;;) {
+        while (*in == ' ' || *in == '\t' || *in == '\r')
+            in++;
+        if (*in == '\0' || *in == '#')
+            return count;
+        char *out = in;
+        args[count++] = out;
+        while (*in != '\0' && *in != ' ' && *in != '\t' && *in != '\r') {
+            if (*in != '"') {
+                *out++ = *in++;
+                continue;
+            }
+            for (in++; *in != '"'; in++) {
+                if (*in == '\0')
+                    throw_error(bad_options, "Unterminated quote.");
+                if (*in == '\\' && (in[1] == '"' || in[1] == '\\'))
+                    in++;
+                *out++ = *in;
+            }
+            in++;
+        }
+        if (*in != '\0')
+            in++;
+        *out = '\0';
+    }
+}
+
+/* Turns a line of the manifest into a job.  Errors are thrown. */
+static void parse_entry(batch_entry_t *entry, char *line) {
+    entry->argv = malloc(sizeof(char *) * ((strlen(line) + 1) / 2 + 2));
+    if (!entry->argv)
+        throw_error(malloc_failed, "run_batch: failed to malloc arguments");
+    entry->argv[0] = "convfont";
+    entry->argc = split_line(line, entry->argv + 1) + 1;
+    entry->argv[entry->argc] = NULL;
+    init_job(&entry->job);
+    if (!parse_job_options(&entry->job, entry->argc, entry->argv))
+        throw_error(bad_options, "-h: Not valid in a batch manifest.");
+}
+
+/* Does parse_entry(), but records any error in the entry instead of throwing
+ * it, so one bad line doesn't stop the rest from being read.
+ * @return Whether the entry parsed and can be run. */
+static bool try_parse_entry(batch_entry_t *entry, char *line) {
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        parse_entry(entry, line);
+        pop_error_trap(&trap);
+        return true;
+    }
+    entry->code = trap.code;
+    memcpy(entry->message, trap.message, sizeof(entry->message));
+    return false;
+}
+
+
+/*******************************************************************************
+*                                  WORKERS                                     *
+*******************************************************************************/
+
+static void run_entry(batch_entry_t *entry) {
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        run_job(&entry->job);
+        pop_error_trap(&trap);
+    } else {
+        entry->code = trap.code;
+        memcpy(entry->message, trap.message, sizeof(entry->message));
+    }
+    free_job(&entry->job);
+}
+
+static void run_worker(worker_t *worker) {
+    batch_t *batch = worker->batch;
+    for (int k = 0; k < batch->slice_count; k++) {
+        work_slice_t *slice = &batch->slices[(worker->id + k) % batch->slice_count];
+        long i;
+        while ((i = claim_next(&slice->next)) < slice->end)
+            run_entry(batch->runnable[i]);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID arg) {
+    run_worker(arg);
+    return 0;
+}
+#else
+static void *worker_main(void *arg) {
+    run_worker(arg);
+    return NULL;
+}
+#endif
+
+static int count_processors(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/* Runs jobs on threads - 1 new threads plus the calling thread. */
+static void run_jobs(batch_entry_t **runnable, int count, int threads) {
+    if (threads > count)
+        threads = count;
+    if (threads < 1)
+        return;
+    batch_t batch;
+    batch.runnable = runnable;
+    batch.slice_count = threads;
+    batch.slices = malloc(sizeof(work_slice_t) * threads);
+    worker_t *workers = malloc(sizeof(worker_t) * threads);
+#ifdef _WIN32
+    HANDLE *handles = malloc(sizeof(HANDLE) * threads);
+#else
+    pthread_t *handles = malloc(sizeof(pthread_t) * threads);
+#endif
+    bool *started = calloc(threads, sizeof(bool));
+    if (!batch.slices || !workers || !handles || !started)
+        throw_error(malloc_failed, "run_batch: failed to malloc workers");
+    for (int i = 0; i < threads; i++) {
+        batch.slices[i].next = (long)count * i / threads;
+        batch.slices[i].end = (long)count * (i + 1) / threads;
+        workers[i].batch = &batch;
+        workers[i].id = i;
+    }
+    /* If a thread can't be started, its slice will just get stolen. */
+    for (int i = 1; i < threads; i++) {
+#ifdef _WIN32
+        handles[i] = CreateThread(NULL, 0, worker_main, &workers[i], 0, NULL);
+        started[i] = handles[i] != NULL;
+#else
+        started[i] = pthread_create(&handles[i], NULL, worker_main, &workers[i]) == 0;
+#endif
+    }
+    run_worker(&workers[0]);
+    for (int i = 1; i < threads; i++) {
+        if (!started[i])
+            continue;
+#ifdef _WIN32
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], NULL);
+#endif
+    }
+    free(started);
+    free(handles);
+    free(workers);
+    free(batch.slices);
+}
+
+
+/*******************************************************************************
+*                                    BATCH                                     *
+*******************************************************************************/
+
+int run_batch(const char *manifest_name, int threads) {
+    FILE *manifest = fopen(manifest_name, "rb");
+    if (!manifest)
+        throw_error(bad_infile, "--batch: Cannot open manifest.");
+    file_buffer_t buffer;
+    if (!map_file(manifest, &buffer))
+        throw_error(bad_infile, "--batch: Failed to read manifest.");
+    fclose(manifest);
+    char *text = malloc(buffer.size + 1);
+    if (!text)
+        throw_error(malloc_failed, "run_batch: failed to malloc manifest");
+    if (buffer.size > 0)
+        memcpy(text, buffer.data, buffer.size);
+    text[buffer.size] = '\0';
+    unmap_file(&buffer);
+
+    int line_count = 1;
+    for (char *c = text; *c != '\0'; c++)
+        if (*c == '\n')
+            line_count++;
+    batch_entry_t *entries = calloc(line_count, sizeof(batch_entry_t));
+    batch_entry_t **runnable = malloc(sizeof(batch_entry_t *) * line_count);
+    if (!entries || !runnable)
+        throw_error(malloc_failed, "run_batch: failed to malloc jobs");
+
+    /* getopt() isn't reentrant, so every line gets parsed up front. */
+    int entry_count = 0;
+    int runnable_count = 0;
+    char *line = text;
+    for (int line_number = 1; line != NULL; line_number++) {
+        char *end = strchr(line, '\n');
+        if (end != NULL)
+            *end++ = '\0';
+        char *c = line;
+        while (*c == ' ' || *c == '\t' || *c == '\r')
+            c++;
+        if (*c != '\0' && *c != '#') {
+            batch_entry_t *entry = &entries[entry_count++];
+            entry->line = line_number;
+            if (try_parse_entry(entry, line))
+                runnable[runnable_count++] = entry;
+        }
+        line = end;
+    }
+
+    if (threads <= 0)
+        threads = count_processors();
+    /* Each job prints as much as its own -v asks for; this is shown if any
+     * of them asked at all. */
+    bool verbose = false;
+    for (int i = 0; i < runnable_count; i++)
+        verbose |= runnable[i]->job.verbosity >= 1;
+    if (verbose)
+        printf("Running %i job(s) on up to %i thread(s) . . .\n", runnable_count, threads);
+    run_jobs(runnable, runnable_count, threads);
+
+    int failures = 0;
+    int code = 0;
+    for (int i = 0; i < entry_count; i++) {
+        if (entries[i].code == 0)
+            continue;
+        fprintf(stderr, "ERROR: %s:%i: %s\n", manifest_name, entries[i].line, entries[i].message);
+        if (failures++ == 0)
+            code = entries[i].code;
+    }
+    printf("Batch finished: %i of %i job(s) failed.\n", failures, entry_count);
+    /* --batch doesn't take -v, so this is shown whenever -k was used. */
+    int hits = 0;
+    int misses = 0;
+    for (int i = 0; i < entry_count; i++) {
+        hits += entries[i].job.cache_hits;
+        misses += entries[i].job.cache_misses;
+    }
+    if (hits + misses > 0)
+        printf("Cache: %i hit(s), %i miss(es).\n", hits, misses);
+
+    for (int i = 0; i < entry_count; i++)
+        free(entries[i].argv);
+    free(runnable);
+    free(entries);
+    free(text);
+    return code;
+}
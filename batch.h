@@ -0,0 +1,16 @@
+#pragma once
+
+#include "convfont.h"
+
+/* Runs every conversion listed in a manifest file.  Each non-blank line of the
+ * manifest holds the options for one run of convfont, without the program
+ * name, e.g.
+ *     -o fontpack -f a.fnt -a 1 -f b.fnt -N "My Fonts" fonts.bin
+ * Arguments containing spaces may be wrapped in double quotes, and # starts a
+ * comment.  The lines are converted in parallel; a failure in one does not
+ * stop the others.
+ * @param manifest_name Path to the manifest.
+ * @param threads Number of worker threads, or 0 to use one per processor.
+ * @return Zero if every job succeeded, otherwise the error code of the first
+ * job that failed. */
+int run_batch(const char *manifest_name, int threads);
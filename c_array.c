@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "c_array.h"
+
+/* Every byte's two hex digits, so each takes one lookup to format. */
+#define HEX_PAIRS(high) high "0" high "1" high "2" high "3" high "4" high "5" high "6" high "7" \
+    high "8" high "9" high "A" high "B" high "C" high "D" high "E" high "F"
+static const char hex_pairs[] =
+    HEX_PAIRS("0") HEX_PAIRS("1") HEX_PAIRS("2") HEX_PAIRS("3")
+    HEX_PAIRS("4") HEX_PAIRS("5") HEX_PAIRS("6") HEX_PAIRS("7")
+    HEX_PAIRS("8") HEX_PAIRS("9") HEX_PAIRS("A") HEX_PAIRS("B")
+    HEX_PAIRS("C") HEX_PAIRS("D") HEX_PAIRS("E") HEX_PAIRS("F");
+#undef HEX_PAIRS
+
+/* Each row is formatted into a buffer and output in one go, since this is the
+ * slowest output format and the biggest. */
+void format_c_array(const uint8_t *data, size_t length, bool unix_newline_style, output_span_t output, void *custom_data) {
+    /* A row, then the comma and newline ending it. */
+    char row[16 * 6 + 3];
+    do {
+        char *p = row;
+        for (int i = 0; i < 16 && length > 0; i++, length--) {
+            if (i) {
+                *p++ = ',';
+                *p++ = ' ';
+            }
+            *p++ = '0';
+            *p++ = 'x';
+            memcpy(p, hex_pairs + 2 * *data++, 2);
+            p += 2;
+        }
+        if (length > 0)
+            *p++ = ',';
+        if (!unix_newline_style)
+            *p++ = '\r';
+        *p++ = '\n';
+        output((const uint8_t *)row, p - row, custom_data);
+    } while (length > 0);
+}
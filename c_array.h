@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "serialize_font.h"
+
+/* Formats data as the body of a C array: rows of 16 bytes like 0x1F,
+ * separated by commas, ending with a newline.  This is what -o carray writes.
+ * @param data The bytes to format.
+ * @param length Size of data in bytes.
+ * @param unix_newline_style false to end lines with CR+LF.
+ * @param output Receives the text, a row at a time. custom_data can be any
+ * data you like, such as a FILE struct. */
+void format_c_array(const uint8_t *data, size_t length, bool unix_newline_style, output_span_t output, void *custom_data);
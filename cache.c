@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "convfont.h"
+#include "cache.h"
+#include "file_buffer.h"
+#include "output_file.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4996)
+#endif
+
+/* Change this whenever convfont's output changes, so that entries written by
+ * older versions are no longer found. */
+#define CACHE_FORMAT "convfont cache 1"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+uint64_t start_cache_key(void) {
+    return hash_cache_string(FNV_OFFSET_BASIS, CACHE_FORMAT);
+}
+
+uint64_t hash_cache_bytes(uint64_t key, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+        key = (key ^ bytes[i]) * FNV_PRIME;
+    return key;
+}
+
+uint64_t hash_cache_int(uint64_t key, int value) {
+    uint8_t bytes[4];
+    bytes[0] = (uint8_t)(value & 255);
+    bytes[1] = (uint8_t)((value >> 8) & 255);
+    bytes[2] = (uint8_t)((value >> 16) & 255);
+    bytes[3] = (uint8_t)((value >> 24) & 255);
+    return hash_cache_bytes(key, bytes, sizeof(bytes));
+}
+
+uint64_t hash_cache_string(uint64_t key, const char *string) {
+    if (string == NULL)
+        return hash_cache_int(key, -1);
+    size_t length = strlen(string);
+    key = hash_cache_int(key, (int)length);
+    return hash_cache_bytes(key, string, length);
+}
+
+bool hash_cache_file(uint64_t *key, const char *file_name) {
+    file_buffer_t buffer;
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL)
+        return false;
+    bool loaded = map_file(file, &buffer);
+    fclose(file);
+    if (!loaded)
+        return false;
+    *key = hash_cache_int(*key, (int)buffer.size);
+    *key = hash_cache_bytes(*key, buffer.data, buffer.size);
+    unmap_file(&buffer);
+    return true;
+}
+
+/* Makes the name of a cache entry.
+ * @return A malloc()ed string, or NULL if malloc() failed. */
+static char *entry_name(const char *directory, uint64_t key) {
+    size_t length = strlen(directory) + 20;
+    char *name = malloc(length);
+    if (name != NULL)
+        snprintf(name, length, "%s/%08lx%08lx", directory, (unsigned long)(key >> 32), (unsigned long)(key & 0xFFFFFFFF));
+    return name;
+}
+
+/* Copies one open file to another.
+ * @return false if anything couldn't be read or written. */
+static bool copy_stream(FILE *from, FILE *to) {
+    char block[16384];
+    size_t length;
+    while ((length = fread(block, 1, sizeof(block), from)) > 0)
+        if (fwrite(block, 1, length, to) != length)
+            return false;
+    return !ferror(from);
+}
+
+bool in_cache(const char *directory, uint64_t key) {
+    char *name = entry_name(directory, key);
+    if (name == NULL)
+        return false;
+    FILE *file = fopen(name, "rb");
+    free(name);
+    if (file == NULL)
+        return false;
+    fclose(file);
+    return true;
+}
+
+void fetch_from_cache(const char *directory, uint64_t key, const char *file_name) {
+    output_file_t output;
+    char *name = entry_name(directory, key);
+    if (name == NULL)
+        throw_error(malloc_failed, "-k: Failed to malloc file name.");
+    FILE *entry = fopen(name, "rb");
+    free(name);
+    if (entry == NULL)
+        throw_error(bad_infile, "-k: Cache entry disappeared.");
+    if (!open_output_file(file_name, &output)) {
+        fclose(entry);
+        throw_error(bad_outfile, "Cannot open output file.");
+    }
+    if (!copy_stream(entry, output.file)) {
+        fclose(entry);
+        discard_output_file(&output);
+        throw_error(bad_outfile, "-k: Failed to copy output from cache.");
+    }
+    fclose(entry);
+    if (close_output_file(&output) == output_failed)
+        throw_error(bad_outfile, "-k: Failed to copy output from cache.");
+}
+
+bool store_in_cache(const char *directory, uint64_t key, const char *file_name) {
+    output_file_t output;
+    bool stored = false;
+    char *name = entry_name(directory, key);
+    FILE *source = fopen(file_name, "rb");
+    if (name != NULL && source != NULL) {
+#ifdef _WIN32
+        _mkdir(directory);
+#else
+        mkdir(directory, 0777);
+#endif
+        if (open_output_file(name, &output)) {
+            if (copy_stream(source, output.file))
+                stored = close_output_file(&output) != output_failed;
+            else
+                discard_output_file(&output);
+        }
+    }
+    if (source != NULL)
+        fclose(source);
+    free(name);
+    return stored;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* A cache of converted output files, for -k.  Each entry is a copy of an
+ * output file, named after a hash of everything that went into making it, so
+ * an entry never goes stale; it just stops being looked up.  The cache is only
+ * an optimization, so trouble storing an entry is never an error. */
+
+/* What every cache key starts from. */
+uint64_t start_cache_key(void);
+
+/* Adds bytes to a cache key.  This is 64-bit FNV-1a.
+ * @param key The key so far.
+ * @param data The bytes to add.
+ * @param size Number of bytes.
+ * @return The new key. */
+uint64_t hash_cache_bytes(uint64_t key, const void *data, size_t size);
+
+/* Adds an int to a cache key. */
+uint64_t hash_cache_int(uint64_t key, int value);
+
+/* Adds a string to a cache key.  NULL and "" give different keys, as do
+ * different ways of splitting the same text between strings. */
+uint64_t hash_cache_string(uint64_t key, const char *string);
+
+/* Adds the contents of a file to a cache key.
+ * @param key The key so far; unchanged if the file can't be read.
+ * @param file_name The file to add.
+ * @return false if the file couldn't be read. */
+bool hash_cache_file(uint64_t *key, const char *file_name);
+
+/* Checks whether the cache has an entry.
+ * @param directory The cache directory.
+ * @param key The entry's key.
+ * @return true if there is one. */
+bool in_cache(const char *directory, uint64_t key);
+
+/* Copies a cache entry to a file.  As with any output, the file is only
+ * replaced if its contents change.  Throws if the file can't be written.
+ * @param directory The cache directory.
+ * @param key The entry's key.
+ * @param file_name Where to copy the entry. */
+void fetch_from_cache(const char *directory, uint64_t key, const char *file_name);
+
+/* Copies a file into the cache, creating the directory if need be.  The entry
+ * is written under a temporary name and then renamed, so a job reading it at
+ * the same time never sees half of it.
+ * @param directory The cache directory.
+ * @param key The entry's key.
+ * @param file_name The file to copy.
+ * @return false if the entry couldn't be stored. */
+bool store_in_cache(const char *directory, uint64_t key, const char *file_name);
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4996)
+#endif
+#include "convfont.h"
+#include "parse_text.h"
+
+/* Lists are small, so an index this big means something is badly wrong. */
+#define MAX_STRING_INDEX_SIZE 65536
+
+/*******************************************************************************
+*                             STYLES AND WEIGHTS                               *
+*******************************************************************************/
+
+string_value_pair_t weight_names[] = {
+    { "thin", 0x20 },
+    { "extra light", 0x30 },
+    { "extralight", 0x30 },
+    { "light", 0x40 },
+    { "semilight", 0x60 },
+    { "normal", 0x80 },
+    { "medium", 0x90 },
+    { "semibold", 0xA0 },
+    { "bold", 0xC0 },
+    { "extra bold", 0xE0 },
+    { "extrabold", 0xE0 },
+    { "black", 0xF0 }
+};
+
+string_list_t weights = {
+    .count = 12, .strings = weight_names
+};
+
+string_value_pair_t style_names[] = {
+    { "sans-serif", 0 },
+    { "sansserif", 0 },
+    { "serif", 1 },
+    { "upright", 0 },
+    { "oblique", 2 },
+    { "italic", 4 },
+    { "monospaced", 8 },
+    { "fixed", 8 },
+    { "proportional", 0 }
+};
+
+string_list_t styles = {
+    .count = 9, .strings = style_names
+};
+
+/* Each slot holds an index into the list's strings plus one, or zero if
+empty. */
+struct string_index {
+    uint32_t mask;
+    uint32_t seed;
+    uint8_t slots[1];
+};
+
+/* FNV-1a of the case-folded string, perturbed by seed. */
+static uint32_t hash_string(const char *string, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (; *string != '\0'; string++)
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*string)) * 16777619u;
+    return hash ^ (hash >> 15);
+}
+
+/* Builds the lookup index for a string list.  We just keep trying seeds until
+every string lands in its own slot, so a lookup is one hash and one compare. */
+void init_string_list(string_list_t *list) {
+    if (list->index != NULL)
+        return;
+    if (list->count >= 255)
+        throw_error(internal_error, "init_string_list: too many strings");
+    /* Two names that differ only in case always hash alike, so no seed would
+    ever separate them. */
+    for (int i = 0; i < list->count; i++)
+        for (int j = i + 1; j < list->count; j++)
+            if (strcaseeq(list->strings[i].string, list->strings[j].string))
+                throw_errorf(internal_error, "init_string_list: \"%s\" is listed twice", list->strings[j].string);
+    uint32_t size = 16;
+    while (size < (uint32_t)list->count * 4)
+        size <<= 1;
+    for (; size <= MAX_STRING_INDEX_SIZE; size <<= 1) {
+        struct string_index *index = malloc(sizeof(struct string_index) + size);
+        if (!index)
+            throw_error(malloc_failed, "init_string_list: failed to malloc index");
+        for (uint32_t seed = 0; seed < 256; seed++) {
+            memset(index->slots, 0, size);
+            int i;
+            for (i = 0; i < list->count; i++) {
+                uint32_t slot = hash_string(list->strings[i].string, seed) & (size - 1);
+                if (index->slots[slot] != 0)
+                    break;
+                index->slots[slot] = (uint8_t)(i + 1);
+            }
+            if (i == list->count) {
+                index->mask = size - 1;
+                index->seed = seed;
+                list->index = index;
+                return;
+            }
+        }
+        free(index);
+    }
+    throw_error(internal_error, "init_string_list: no collision-free index found");
+}
+
+static error_trap_t string_lists_trap;
+
+static void build_string_lists(void) {
+    push_error_trap(&string_lists_trap);
+    if (setjmp(string_lists_trap.jump) == 0) {
+        init_string_list(&weights);
+        init_string_list(&styles);
+        init_string_list(&font_tags);
+        init_string_list(&glyph_tags);
+        init_string_list(&bools);
+        pop_error_trap(&string_lists_trap);
+    }
+}
+
+#ifdef _WIN32
+static INIT_ONCE string_lists_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK build_string_lists_once(PINIT_ONCE once, PVOID parameter, PVOID *context) {
+    (void)once;
+    (void)parameter;
+    (void)context;
+    build_string_lists();
+    return TRUE;
+}
+#else
+static pthread_once_t string_lists_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* The indexes are built only once, and are never changed after, so any number
+of threads can look things up without locking.  An error building them is
+thrown again to everyone who asks. */
+void init_string_lists(void) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(&string_lists_once, build_string_lists_once, NULL, NULL);
+#else
+    pthread_once(&string_lists_once, build_string_lists);
+#endif
+    if (string_lists_trap.code != 0)
+        rethrow_error(&string_lists_trap);
+}
+
+/* Compares a string against a list of strings and numeric values to associate
+with that string.  Returns -1 if no match is found. */
+int check_string_for_value(const char *string, const string_list_t *possible_values) { 
+    const struct string_index *index = possible_values->index;
+    if (index == NULL)
+        throw_error(internal_error, "check_string_for_value: init_string_lists() was never called");
+    int i = index->slots[hash_string(string, index->seed) & index->mask];
+    if (i != 0 && strcaseeq(string, possible_values->strings[i - 1].string))
+        return possible_values->strings[i - 1].value;
+    return -1;
+}
+
+bool strcaseeq(const char *str1, const char *str2) {
+    for (; *str1 != '\0' && *str2 != '\0'; str1++, str2++)
+        if (tolower((unsigned char)*str1) != tolower((unsigned char)*str2))
+            return false;
+    return *str1 == *str2;
+}
+
+
+/*******************************************************************************
+*                                   ERRORS                                     *
+*******************************************************************************/
+
+THREAD_LOCAL int verbosity = 0;
+
+static THREAD_LOCAL error_trap_t *current_error_trap = NULL;
+
+void push_error_trap(error_trap_t *trap) {
+    trap->code = 0;
+    trap->message[0] = '\0';
+    trap->previous = current_error_trap;
+    current_error_trap = trap;
+}
+
+void pop_error_trap(error_trap_t *trap) {
+    current_error_trap = trap->previous;
+}
+
+noreturn void throw_error(const int code, const char *string) {
+    if (string != NULL)
+        throw_errorf(code, "%s", string);
+    throw_errorf(code, NULL);
+}
+
+
+noreturn void throw_errorf(const int code, const char *string, ...) {
+    va_list argp;
+    va_start(argp, string);
+    vthrow_errorf(code, string, argp);
+    va_end(argp);
+}
+
+
+noreturn void vthrow_errorf(const int code, const char *string, va_list args) {
+    error_trap_t *trap = current_error_trap;
+    if (trap != NULL) {
+        trap->code = code;
+        if (string != NULL)
+            vsnprintf(trap->message, sizeof(trap->message), string, args);
+        pop_error_trap(trap);
+        longjmp(trap->jump, 1);
+    }
+    if (string != NULL) {
+        fprintf(stderr, "ERROR: ");
+        vfprintf(stderr, string, args);
+        fprintf(stderr, "\n");
+    }
+    exit(code);
+}
+
+
+noreturn void rethrow_error(const error_trap_t *trap) {
+    throw_error(trap->code, trap->message[0] != '\0' ? trap->message : NULL);
+}
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <setjmp.h>
 
 #ifdef _MSC_VER
 #define noreturn __declspec(noreturn)
@@ -15,10 +16,17 @@
 #endif
 #endif
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #define MAX_APPVAR_SIZE 0xFFE8
 #define MEATADATA_STRUCT_SIZE 21
 
-extern int verbosity;
+/* Each thread has its own verbosity level. */
+extern THREAD_LOCAL int verbosity;
 
 typedef enum {
     output_unspecified = 0,
@@ -36,6 +44,8 @@ typedef enum {
     malloc_failed,
     internal_error,
     text_parser_error,
+    buffer_too_small,
+    connection_failed,
 } error_codes_t;
 
 /* This definition just adds some typing to otherwise opaque chunks of data. */
@@ -93,7 +103,32 @@ return ((width - 1) >> 3) + 1;
 #define byte_columns(width) ((((width) - 1) >> 3) + 1)
 
 /**
- * Displays an error and exits.
+ * Lets a caller catch throw_error() and friends instead of exiting.
+ * Usage:
+ *     error_trap_t trap;
+ *     push_error_trap(&trap);
+ *     if (setjmp(trap.jump) == 0) {
+ *         ... code that may throw ...
+ *         pop_error_trap(&trap);
+ *     } else {
+ *         ... trap.code and trap.message describe the error ...
+ *     }
+ * The trap is popped automatically when an error is caught.  Traps are
+ * per-thread.
+ */
+typedef struct error_trap {
+    jmp_buf jump;
+    int code;
+    char message[256];
+    struct error_trap *previous;
+} error_trap_t;
+
+void push_error_trap(error_trap_t *trap);
+
+void pop_error_trap(error_trap_t *trap);
+
+/**
+ * Displays an error and exits, or jumps to the innermost error trap.
  */
 noreturn void throw_error(const int code, const char *string);
 
@@ -107,6 +142,11 @@ noreturn void throw_errorf(const int code, const char *string, ...);
 */
 noreturn void vthrow_errorf(const int code, const char *string, va_list args);
 
+/**
+ * Throws a caught error again, for use after cleaning up.
+ */
+noreturn void rethrow_error(const error_trap_t *trap);
+
 
 
 /*******************************************************************************
@@ -118,11 +158,29 @@ typedef struct {
     uint8_t value;
 } string_value_pair_t;
 
+struct string_index;
+
 typedef struct {
     int count;
     string_value_pair_t *strings;
+    /* Perfect hash of the case-folded strings, built by init_string_lists(). */
+    struct string_index *index;
 } string_list_t;
 
+/**
+ * Builds the lookup index for a string list.  Throws internal_error if two of
+ * its strings differ only in case.  Not thread-safe; the built-in lists are
+ * done by init_string_lists().
+ */
+void init_string_list(string_list_t *list);
+
+/**
+ * Builds the lookup indexes for all of the built-in string lists, the first
+ * time it is called.  Must be called before check_string_for_value(); safe to
+ * call from any number of threads.
+ */
+void init_string_lists(void);
+
 /**
  * Compares a string against a list of strings and numeric values to associate
  * with that string.  Returns -1 if no match is found.
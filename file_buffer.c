@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "convfont.h"
+#include "file_buffer.h"
+
+/* Loads an entire already-opened file into memory.
+ * @param file The file to load; its current position is ignored.
+ * @param buffer Receives the file's contents.
+ * @return false on failure. */
+bool map_file(FILE *file, file_buffer_t *buffer) {
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->mapped = false;
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0)
+            return true;
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (map != MAP_FAILED) {
+            buffer->data = map;
+            buffer->size = (size_t)st.st_size;
+            buffer->mapped = true;
+            return true;
+        }
+    }
+#endif
+    /* Fall back to reading the whole thing in one go. */
+    if (fseek(file, 0, SEEK_END))
+        return false;
+    long size = ftell(file);
+    if (size < 0 || fseek(file, 0, SEEK_SET))
+        return false;
+    if (size == 0)
+        return true;
+    uint8_t *data = malloc((size_t)size);
+    if (!data)
+        return false;
+    if (fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        return false;
+    }
+    buffer->data = data;
+    buffer->size = (size_t)size;
+    return true;
+}
+
+/* Releases a buffer obtained from map_file(). */
+void unmap_file(file_buffer_t *buffer) {
+#ifndef _WIN32
+    if (buffer->mapped)
+        munmap((void *)buffer->data, buffer->size);
+    else
+#endif
+        free((void *)buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->mapped = false;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* A read-only, in-memory image of an entire input file.  Where the platform
+ * supports it, the file is mmap()ed; otherwise, it is read in with a single
+ * fread(). */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    /* Internal: true if data must be munmap()ed instead of free()d. */
+    bool mapped;
+} file_buffer_t;
+
+/* Loads an entire already-opened file into memory.
+ * @param file The file to load; its current position is ignored.
+ * @param buffer Receives the file's contents.
+ * @return false on failure. */
+bool map_file(FILE *file, file_buffer_t *buffer);
+
+/* Releases a buffer obtained from map_file(). */
+void unmap_file(file_buffer_t *buffer);
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "convfont.h"
+#include "image.h"
+#include "pack_bitmaps.h"
+#include "serialize_font.h"
+
+#define FONTPACK_HEADER_SIZE 12
+
+/* Puts the metadata strings in storage order so they can be looped over. */
+static void metadata_strings(const fontpack_metadata_t *metadata, char *strings[FONTPACK_METADATA_STRINGS]) {
+    strings[0] = metadata->name;
+    strings[1] = metadata->author;
+    strings[2] = metadata->pseudocopyright;
+    strings[3] = metadata->description;
+    strings[4] = metadata->version;
+    strings[5] = metadata->codepage;
+}
+
+static uint8_t *put_ezword(uint8_t *dest, uint32_t data) {
+    *dest++ = (uint8_t)(data & 255);
+    *dest++ = (uint8_t)((data >> 8) & 255);
+    *dest++ = (uint8_t)((data >> 16) & 255);
+    return dest;
+}
+
+/* Span sink that copies into memory, advancing a cursor. */
+static void output_span_cursor(const uint8_t *data, size_t length, void *custom_data) {
+    uint8_t **cursor = (uint8_t **)custom_data;
+    memcpy(*cursor, data, length);
+    *cursor += length;
+}
+
+/* Lets each font in a pack borrow bitmaps from the fonts after it.  A font's
+ * offsets are relative to its own header and can only point forward, so a
+ * bitmap used by several fonts has to be stored in the last of them.  So,
+ * working from the last font back, each font's glyphs are looked up among the
+ * bitmaps stored by later fonts, and only what isn't found is packed into the
+ * font itself.  The fonts are never reordered to help: a pack can't exceed
+ * 64 K, so every forward offset is in range anyway.
+ * @param lenders Receives font * 256 + glyph of the bitmap each glyph
+ * borrows, or -1 if it uses its own. */
+static void share_bitmaps(fontlib_font_t **fonts, int count, bitmap_packing_t packing, packed_bitmaps_t *packed, int *lenders) {
+    size_t slot_count = 1024;
+    while (slot_count < (size_t)count * 512)
+        slot_count *= 2;
+    int *slots = malloc(slot_count * sizeof(int));
+    if (slots == NULL)
+        throw_error(malloc_failed, "layout_fontpack: failed to malloc bitmap table");
+    memset(slots, -1, slot_count * sizeof(int));
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        for (int f = count - 1; f >= 0; f--) {
+            fontlib_font_t *font = fonts[f];
+            bool borrowed[256];
+            for (int i = 0; i < font->total_glyphs; i++) {
+                size_t slot = hash_bitmap(byte_columns(font->widths_table[i]), font->bitmaps[i]) & (slot_count - 1);
+                for (; slots[slot] >= 0; slot = (slot + 1) & (slot_count - 1))
+                    if (same_bitmap(fonts[slots[slot] >> 8], slots[slot] & 255, font, i))
+                        break;
+                lenders[f * 256 + i] = slots[slot];
+                borrowed[i] = slots[slot] >= 0;
+            }
+            pack_bitmaps(font, packing, borrowed, &packed[f]);
+            /* Offer this font's own bitmaps to the fonts before it. */
+            for (int i = 0; i < font->total_glyphs; i++) {
+                if (borrowed[i])
+                    continue;
+                size_t slot = hash_bitmap(byte_columns(font->widths_table[i]), font->bitmaps[i]) & (slot_count - 1);
+                for (; slots[slot] >= 0; slot = (slot + 1) & (slot_count - 1))
+                    if (same_bitmap(fonts[slots[slot] >> 8], slots[slot] & 255, font, i))
+                        break;
+                if (slots[slot] < 0)
+                    slots[slot] = f * 256 + i;
+            }
+        }
+        pop_error_trap(&trap);
+    } else {
+        free(slots);
+        rethrow_error(&trap);
+    }
+    free(slots);
+}
+
+/* Bytes the metadata struct and its strings take up, or 0 if there are none. */
+static int metadata_size(const fontpack_metadata_t *metadata) {
+    char *strings[FONTPACK_METADATA_STRINGS];
+    int size = 0;
+    metadata_strings(metadata, strings);
+    for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+        if (strings[i] != NULL) {
+            if (size == 0)
+                size = MEATADATA_STRUCT_SIZE;
+            size += (int)strlen(strings[i]) + 1;
+        }
+    return size;
+}
+
+/* Does the work of layout_fontpack(), except for checking the size. */
+static void plan_fontpack(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, fontpack_layout_t *layout) {
+    char *strings[FONTPACK_METADATA_STRINGS];
+    metadata_strings(metadata, strings);
+    if (count < 1 || count > 255)
+        throw_error(bad_options, "Font pack must contain between 1 and 255 fonts.");
+    int location = FONTPACK_HEADER_SIZE + count * 3;
+    layout->metadata_offset = 0;
+    for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++) {
+        layout->string_offsets[i] = 0;
+        if (strings[i] != NULL)
+            layout->metadata_offset = location;
+    }
+    if (layout->metadata_offset != 0) {
+        location += MEATADATA_STRUCT_SIZE;
+        for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+            if (strings[i] != NULL) {
+                layout->string_offsets[i] = location;
+                location += (int)strlen(strings[i]) + 1;
+            }
+    }
+    layout->font_count = count;
+    layout->bitmaps = malloc(count * sizeof(packed_bitmaps_t));
+    int *lenders = malloc(count * 256 * sizeof(int));
+    if (layout->bitmaps == NULL || lenders == NULL) {
+        free(layout->bitmaps);
+        free(lenders);
+        throw_error(malloc_failed, "layout_fontpack: failed to malloc bitmap layouts");
+    }
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        if (packing == packing_none)
+            for (int f = 0; f < count; f++) {
+                pack_bitmaps(fonts[f], packing_none, NULL, &layout->bitmaps[f]);
+                for (int i = 0; i < fonts[f]->total_glyphs; i++)
+                    lenders[f * 256 + i] = -1;
+            }
+        else
+            share_bitmaps(fonts, count, packing, layout->bitmaps, lenders);
+        pop_error_trap(&trap);
+    } else {
+        free(layout->bitmaps);
+        free(lenders);
+        rethrow_error(&trap);
+    }
+    layout->saved = 0;
+    for (int f = 0; f < count; f++) {
+        layout->font_offsets[f] = location;
+        location += compute_font_size(fonts[f], &layout->bitmaps[f]);
+        layout->saved += layout->bitmaps[f].saved;
+    }
+    /* Now that every font has a place, borrowed bitmaps can be found. */
+#define BITMAPS_START(f) (layout->font_offsets[f] + 18 + 3 * fonts[f]->total_glyphs)
+    for (int f = 0; f < count; f++)
+        for (int i = 0; i < fonts[f]->total_glyphs; i++) {
+            int lender = lenders[f * 256 + i];
+            if (lender >= 0)
+                layout->bitmaps[f].offsets[i] = BITMAPS_START(lender >> 8) + layout->bitmaps[lender >> 8].offsets[lender & 255] - BITMAPS_START(f);
+        }
+#undef BITMAPS_START
+    free(lenders);
+    layout->size = (size_t)location;
+}
+
+void layout_fontpack(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, fontpack_layout_t *layout) {
+    plan_fontpack(fonts, count, metadata, packing, layout);
+    if (layout->size >= MAX_APPVAR_SIZE) {
+        free_fontpack_layout(layout);
+        throw_error(bad_options, "Cannot form appvar; output appvar size would exceed 64 K appvar size limit.");
+    }
+}
+
+int split_fontpack(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, int *packs) {
+    int sizes[256];
+    int order[256];
+    int pack_sizes[256];
+    int pack_counts[256];
+    int pack_count = 0;
+    int overhead = FONTPACK_HEADER_SIZE + metadata_size(metadata);
+    packed_bitmaps_t packed;
+    if (count < 1 || count > 255)
+        throw_error(bad_options, "Font pack must contain between 1 and 255 fonts.");
+    /* Exact sizes of each font on its own, biggest first. */
+    for (int i = 0; i < count; i++) {
+        pack_bitmaps(fonts[i], packing, NULL, &packed);
+        sizes[i] = compute_font_size(fonts[i], &packed);
+        int j = i;
+        for (; j > 0 && sizes[order[j - 1]] < sizes[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    /* First fit decreasing, as if each font were packed on its own. */
+    for (int o = 0; o < count; o++) {
+        int i = order[o];
+        int p = 0;
+        for (; p < pack_count; p++)
+            if (overhead + 3 * (pack_counts[p] + 1) + pack_sizes[p] + sizes[i] < MAX_APPVAR_SIZE)
+                break;
+        if (p == pack_count) {
+            if (overhead + 3 + sizes[i] >= MAX_APPVAR_SIZE)
+                throw_errorf(bad_options, "Font %i is too big to fit in an appvar even on its own.", i + 1);
+            pack_sizes[pack_count] = 0;
+            pack_counts[pack_count++] = 0;
+        }
+        pack_sizes[p] += sizes[i];
+        pack_counts[p]++;
+        packs[i] = p;
+    }
+    /* Number the packs in the order of their first fonts. */
+    int renumber[256];
+    int next = 0;
+    for (int p = 0; p < pack_count; p++)
+        renumber[p] = -1;
+    for (int i = 0; i < count; i++) {
+        if (renumber[packs[i]] < 0)
+            renumber[packs[i]] = next++;
+        packs[i] = renumber[packs[i]];
+    }
+    return pack_count;
+}
+
+void free_fontpack_layout(fontpack_layout_t *layout) {
+    free(layout->bitmaps);
+    layout->bitmaps = NULL;
+}
+
+void write_fontpack_image(fontlib_font_t **fonts, const fontpack_metadata_t *metadata, const fontpack_layout_t *layout, uint8_t *dest) {
+    char *strings[FONTPACK_METADATA_STRINGS];
+    metadata_strings(metadata, strings);
+    uint8_t *start = dest;
+    /* Header */
+    memcpy(dest, "FONTPACK", 8);
+    dest = put_ezword(dest + 8, layout->metadata_offset);
+    *dest++ = (uint8_t)layout->font_count;
+    /* Fonts table */
+    for (int i = 0; i < layout->font_count; i++)
+        dest = put_ezword(dest, layout->font_offsets[i]);
+    /* Metadata */
+    if (layout->metadata_offset != 0) {
+        dest = put_ezword(dest, MEATADATA_STRUCT_SIZE);
+        for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+            dest = put_ezword(dest, layout->string_offsets[i]);
+        for (int i = 0; i < FONTPACK_METADATA_STRINGS; i++)
+            if (strings[i] != NULL) {
+                size_t length = strlen(strings[i]) + 1;
+                memcpy(dest, strings[i], length);
+                dest += length;
+            }
+    }
+    /* Fonts */
+    for (int i = 0; i < layout->font_count; i++) {
+        if (dest - start != layout->font_offsets[i])
+            throw_error(internal_error, "write_fontpack_image: font landed in the wrong place.");
+        uint8_t *cursor = dest;
+        serialize_packed_font_spans(fonts[i], &layout->bitmaps[i], output_span_cursor, &cursor);
+        dest = cursor;
+    }
+    if ((size_t)(dest - start) != layout->size)
+        throw_error(internal_error, "write_fontpack_image: size mismatch.");
+}
+
+uint8_t *build_font_image(fontlib_font_t *font, bitmap_packing_t packing, size_t *size, int *saved) {
+    /* Overlap packing is slow, so the layout that gives the size is the one
+     * that gets written. */
+    packed_bitmaps_t packed;
+    pack_bitmaps(font, packing, NULL, &packed);
+    *size = (size_t)compute_font_size(font, &packed);
+    if (saved != NULL)
+        *saved = packed.saved;
+    uint8_t *image = malloc(*size);
+    if (image == NULL)
+        throw_error(malloc_failed, "build_font_image: failed to malloc image");
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        uint8_t *cursor = image;
+        serialize_packed_font_spans(font, &packed, output_span_cursor, &cursor);
+        if ((size_t)(cursor - image) != *size)
+            throw_error(internal_error, "build_font_image: size mismatch.");
+        pop_error_trap(&trap);
+    } else {
+        free(image);
+        rethrow_error(&trap);
+    }
+    return image;
+}
+
+/* Does the work of build_fontpack_image() once the layout is known, and frees
+ * the layout. */
+static uint8_t *build_laid_out_fontpack(fontlib_font_t **fonts, const fontpack_metadata_t *metadata, fontpack_layout_t *layout, size_t *size, int *saved) {
+    uint8_t *image = malloc(layout->size);
+    if (image == NULL) {
+        free_fontpack_layout(layout);
+        throw_error(malloc_failed, "build_fontpack_image: failed to malloc image");
+    }
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        write_fontpack_image(fonts, metadata, layout, image);
+        pop_error_trap(&trap);
+    } else {
+        free(image);
+        free_fontpack_layout(layout);
+        rethrow_error(&trap);
+    }
+    free_fontpack_layout(layout);
+    *size = layout->size;
+    if (saved != NULL)
+        *saved = layout->saved;
+    return image;
+}
+
+uint8_t *build_fontpack_image(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, size_t *size, int *saved) {
+    fontpack_layout_t layout;
+    layout_fontpack(fonts, count, metadata, packing, &layout);
+    return build_laid_out_fontpack(fonts, metadata, &layout, size, saved);
+}
+
+uint8_t *build_fontpack_image_if_fits(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, size_t *size, int *saved) {
+    fontpack_layout_t layout;
+    plan_fontpack(fonts, count, metadata, packing, &layout);
+    if (layout.size >= MAX_APPVAR_SIZE) {
+        free_fontpack_layout(&layout);
+        *size = layout.size;
+        return NULL;
+    }
+    return build_laid_out_fontpack(fonts, metadata, &layout, size, saved);
+}
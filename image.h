@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convfont.h"
+#include "pack_bitmaps.h"
+
+/* Strings describing a font pack, in the order they are stored.  Any of them
+ * may be NULL to leave it out. */
+typedef struct {
+    char *name;
+    char *author;
+    char *pseudocopyright;
+    char *description;
+    char *version;
+    char *codepage;
+} fontpack_metadata_t;
+
+#define FONTPACK_METADATA_STRINGS 6
+
+/* Where everything in a font pack goes.  Every offset in a font pack comes
+ * from here. */
+typedef struct {
+    /* Offset of the metadata struct, or 0 if there is no metadata. */
+    int metadata_offset;
+    /* Offsets of each metadata string, or 0 for ones left out. */
+    int string_offsets[FONTPACK_METADATA_STRINGS];
+    int font_count;
+    int font_offsets[256];
+    /* Where each font's bitmaps go.  Bitmaps a font borrows from a later font
+     * have offsets past the end of the font. */
+    packed_bitmaps_t *bitmaps;
+    /* Bytes saved by bitmap packing, both within and between fonts. */
+    int saved;
+    /* Total size of the font pack in bytes. */
+    size_t size;
+} fontpack_layout_t;
+
+/* Works out where each part of a font pack goes.  Throws if the result would
+ * not fit in an appvar.  Unless packing is packing_none, identical bitmaps are
+ * stored only once across the whole pack.
+ * @param fonts The fonts to pack.
+ * @param count Number of fonts.
+ * @param metadata Strings describing the pack.
+ * @param packing How to pack bitmaps.
+ * @param layout Receives the layout, which must be passed to
+ * free_fontpack_layout() later. */
+void layout_fontpack(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, fontpack_layout_t *layout);
+
+/* Divides fonts among as few font packs as possible, each small enough for an
+ * appvar and each carrying the same metadata.  This is first fit decreasing
+ * bin packing, using each font's exact size on its own.  Sharing bitmaps
+ * between fonts nearly always makes a pack smaller than that, but greedy
+ * overlap packing doesn't promise it, so build_fontpack_image_if_fits() is
+ * the way to build each pack.
+ * @param fonts The fonts to divide up.
+ * @param count Number of fonts.
+ * @param metadata Strings describing each pack.
+ * @param packing How to pack bitmaps.
+ * @param packs Receives, for each font, the number of the pack it goes in.
+ * Packs are numbered from 0 in the order of the first font in each.
+ * @return The number of packs needed. */
+int split_fontpack(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, int *packs);
+
+/* Releases memory held by a font pack layout.
+ * @param layout The layout, from layout_fontpack(). */
+void free_fontpack_layout(fontpack_layout_t *layout);
+
+/* Serializes a font pack into memory.
+ * @param fonts The fonts to pack.
+ * @param metadata Strings describing the pack.
+ * @param layout The pack's layout, from layout_fontpack().
+ * @param dest Where to write the pack; must have room for layout->size bytes. */
+void write_fontpack_image(fontlib_font_t **fonts, const fontpack_metadata_t *metadata, const fontpack_layout_t *layout, uint8_t *dest);
+
+/* Serializes a font into a malloc()ed buffer of exactly the right size.
+ * @param font The font to serialize.
+ * @param packing How to pack its bitmaps.
+ * @param size Receives the size of the buffer.
+ * @param saved If not NULL, receives the bytes saved by bitmap packing.
+ * @return The buffer, which the caller must free(). */
+uint8_t *build_font_image(fontlib_font_t *font, bitmap_packing_t packing, size_t *size, int *saved);
+
+/* Serializes a font pack into a malloc()ed buffer of exactly the right size.
+ * @param fonts The fonts to pack.
+ * @param count Number of fonts.
+ * @param metadata Strings describing the pack.
+ * @param packing How to pack bitmaps.
+ * @param size Receives the size of the buffer.
+ * @param saved If not NULL, receives the bytes saved by bitmap packing.
+ * @return The buffer, which the caller must free(). */
+uint8_t *build_fontpack_image(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, size_t *size, int *saved);
+
+/* The same, except that a font pack too big for an appvar isn't an error.
+ * Packing bitmaps is the slow part, so this is how to find out whether fonts
+ * fit in one pack without packing them twice.
+ * @return The buffer, or NULL if the pack doesn't fit, in which case size
+ * still receives the size it would have been. */
+uint8_t *build_fontpack_image_if_fits(fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, bitmap_packing_t packing, size_t *size, int *saved);
@@ -0,0 +1,1090 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _MSC_VER
+#include "getopt.h"
+#pragma warning(disable : 4996)
+#else
+#include <getopt.h>
+#endif
+#include "convfont.h"
+#include "job.h"
+#include "parse_fnt.h"
+#include "parse_fon.h"
+#include "parse_text.h"
+#include "image.h"
+#include "pack_bitmaps.h"
+#include "appvar.h"
+#include "asm_output.h"
+#include "c_array.h"
+#include "cache.h"
+#include "output_file.h"
+#include "snapshot.h"
+
+
+/*******************************************************************************
+*                         SOME OUTPUT-RELATED STUFF                            *
+*******************************************************************************/
+
+/* Output span callback for a FILE. */
+static void output_file_span(const uint8_t *data, size_t length, void *custom_data) {
+    fwrite(data, 1, length, (FILE *)custom_data);
+}
+
+
+
+/*******************************************************************************
+*                                  OPTIONS                                     *
+*******************************************************************************/
+
+void init_job(conversion_job_t *job) {
+    memset(job, 0, sizeof(conversion_job_t));
+    job->packing = packing_overlap;
+#ifdef _WIN32
+    job->unix_newline_style = false;
+#else
+    job->unix_newline_style = true;
+#endif
+}
+
+/* Starts a new input, with no metrics overridden. */
+static job_input_t *add_input(conversion_job_t *job, input_types_t type, char *file_name) {
+    job_input_t *input = &job->inputs[job->input_count++];
+    input->type = type;
+    input->file_name = file_name;
+    input->space_above = -1;
+    input->space_below = -1;
+    input->italic_space_adjust = -1;
+    input->weight = -1;
+    input->cap_height = -1;
+    input->x_height = -1;
+    input->baseline_height = -1;
+    input->style = 0;
+    return input;
+}
+
+/* Whether every output is a font pack, so that several fonts are allowed. */
+static bool only_fontpacks(conversion_job_t *job) {
+    for (int i = 0; i < job->output_count; i++)
+        if (job->outputs[i].format != output_fontpack)
+            return false;
+    return job->output_count > 0;
+}
+
+/* Whether any output is a font pack, so that metadata is wanted. */
+static bool any_fontpack(conversion_job_t *job) {
+    for (int i = 0; i < job->output_count; i++)
+        if (job->outputs[i].format == output_fontpack)
+            return true;
+    return false;
+}
+
+static bool any_appvar(conversion_job_t *job) {
+    for (int i = 0; i < job->output_count; i++)
+        if (job->outputs[i].appvar)
+            return true;
+    return false;
+}
+
+/* What each -o format name means.  Older versions only looked at the first
+ * letter, so those single letters are still taken as the formats they always
+ * meant, but anything longer has to be spelled out in full; appvar and
+ * asmfontpack would otherwise be mistaken for asmarray. */
+typedef struct {
+    const char *name;
+    output_formats_t format;
+    bool appvar;
+    bool archived;
+    bool assembly;
+} format_name_t;
+
+static const format_name_t format_names[] = {
+    { "carray", output_c_array, false, false, false },
+    { "asmarray", output_asm_array, false, false, false },
+    { "fontpack", output_fontpack, false, false, false },
+    { "binary", output_binary_blob, false, false, false },
+    /* An appvar is a font pack in a .8xv file, and asmfontpack is one as
+     * assembly source. */
+    { "appvar", output_fontpack, true, false, false },
+    { "appvar-archived", output_fontpack, true, true, false },
+    { "asmfontpack", output_fontpack, false, false, true },
+    { "c", output_c_array, false, false, false },
+    { "a", output_asm_array, false, false, false },
+    { "f", output_fontpack, false, false, false },
+    { "p", output_fontpack, false, false, false },
+    { "b", output_binary_blob, false, false, false },
+};
+
+/* Parses the argument of -o, which is a format name, optionally followed by
+ * = and the file to write. */
+static void add_output(conversion_job_t *job, char *argument) {
+    char *equals = strchr(argument, '=');
+    size_t length = equals != NULL ? (size_t)(equals - argument) : strlen(argument);
+    if (job->output_count >= MAX_OUTPUTS)
+        throw_error(bad_options, "-o: Too many outputs.");
+    job_output_t *output = &job->outputs[job->output_count++];
+    memset(output, 0, sizeof(job_output_t));
+    if (equals != NULL) {
+        if (equals[1] == '\0')
+            throw_error(bad_options, "-o: No file name after =.");
+        output->file_name = equals + 1;
+    }
+    for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        const format_name_t *name = &format_names[i];
+        if (strlen(name->name) != length || strncmp(argument, name->name, length) != 0)
+            continue;
+        output->format = name->format;
+        output->appvar = name->appvar;
+        output->archived = name->archived;
+        output->assembly = name->assembly;
+        return;
+    }
+    throw_error(bad_options, "-o: Unknown output format.");
+}
+
+bool parse_job_options(conversion_job_t *job, int argc, char *argv[]) {
+    /* Metrics apply to every font loaded from the most recent input file. */
+    job_input_t *current_input = NULL;
+    int temp_n;
+    size_t strl;
+
+    int option;
+
+    /* Start getopt() over; glibc needs 0 to also forget its internal state. */
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optind = 1;
+#endif
+    while ((option = getopt(argc, argv, "hvo:p:Sn:k:M:uZf:F:a:b:i:w:s:c:x:l:N:A:C:D:V:P:t:")) != -1) {
+        switch (option) {
+            case 'h':
+                return false;
+            case 'v':
+                job->verbosity++;
+                break;
+            case 'o':
+                add_output(job, optarg);
+                break;
+            case 'p':
+                if (strcmp(optarg, "none") == 0)
+                    job->packing = packing_none;
+                else if (strcmp(optarg, "dedup") == 0)
+                    job->packing = packing_dedup;
+                else if (strcmp(optarg, "overlap") == 0)
+                    job->packing = packing_overlap;
+                else
+                    throw_error(bad_options, "-p: Unknown packing mode.");
+                break;
+            case 'S':
+                job->split_fontpack = true;
+                break;
+            case 'n':
+                check_appvar_name(optarg);
+                job->appvar_name = optarg;
+                break;
+            case 'k':
+                job->cache_directory = optarg;
+                break;
+            case 'M':
+                job->dependency_file_name = optarg;
+                break;
+            case 'u':
+                job->snapshots = true;
+                break;
+            case 'Z':
+                job->unix_newline_style = false;
+                break;
+            case 'z':
+                job->unix_newline_style = true;
+                break;
+            case 'f':
+                if (job->input_count > 0 && !only_fontpacks(job))
+                    throw_error(bad_options, "-f: Cannot have multiple input fonts unless -o fontpack is specified first.");
+                if (job->input_count >= MAX_FONTS - 1)
+                    throw_error(bad_options, "-f: Too many fonts.  What on Earth makes you think your font pack needs so many fonts?");
+                current_input = add_input(job, input_fnt, optarg);
+                break;
+            case 'F':
+                if (job->input_count > 0 && !only_fontpacks(job))
+                    throw_error(bad_options, "-F: Cannot have multiple input fonts unless -o fontpack is specified first.");
+                if (job->input_count >= MAX_FONTS - 1)
+                    throw_error(bad_options, "-F: Too many fonts.  What on Earth makes you think your font pack needs so many fonts?");
+                current_input = add_input(job, input_fon, optarg);
+                break;
+            case 't':
+                if (job->input_count > 0 && !only_fontpacks(job))
+                    throw_error(bad_options, "-f: Cannot have multiple input fonts unless -o fontpack is specified first.");
+                if (job->input_count >= MAX_FONTS - 1)
+                    throw_error(bad_options, "-f: Too many fonts.  What on Earth makes you think your font pack needs so many fonts?");
+                current_input = add_input(job, input_text, optarg);
+                break;
+
+            case 'a':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-a: Must specify a font before specifying metrics.");
+                temp_n = (int)strtol(optarg, NULL, 0);
+                if (temp_n > 64 || temp_n < 0)
+                    throw_error(bad_options, "-a: Number too large or small.");
+                current_input->space_above = temp_n;
+                break;
+            case 'b':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-b: Must specify a font before specifying metrics.");
+                temp_n = (int)strtol(optarg, NULL, 0);
+                if (temp_n > 64 || temp_n < 0)
+                    throw_error(bad_options, "-b: Number too large or small.");
+                current_input->space_below = temp_n;
+                break;
+            case 'i':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-i: Must specify a font before specifying metrics.");
+                temp_n = (int)strtol(optarg, NULL, 0);
+                if (temp_n > 24 || temp_n < 0)
+                    throw_error(bad_options, "-i: Number too large or small.");
+                current_input->italic_space_adjust = temp_n;
+                break;
+            case 'w':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-w: Must specify a font before specifying metrics.");
+                temp_n = check_string_for_value(optarg, &weights);
+                if (temp_n == -1) {
+                    temp_n = (int)strtol(optarg, NULL, 0);
+                    if (temp_n > 255 || temp_n < 0)
+                        throw_error(bad_options, "-w: Number too large or small.");
+                }
+                current_input->weight = temp_n;
+                break;
+            case 's':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-s: Must specify a font before specifying metrics.");
+                temp_n = check_string_for_value(optarg, &styles);
+                if (temp_n == -1) {
+                    temp_n = (int)strtol(optarg, NULL, 0);
+                    if (temp_n > 255 || temp_n < 0)
+                        throw_error(bad_options, "-s: Number too large or small.");
+                }
+                current_input->style |= (uint8_t)temp_n;
+                break;
+            /* These are checked against the font's height once it's loaded. */
+            case 'c':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-c: Must specify a font before specifying metrics.");
+                temp_n = (int)strtol(optarg, NULL, 0);
+                if (temp_n < 0)
+                    throw_error(bad_options, "-c: Number too large or small.");
+                current_input->cap_height = temp_n;
+                break;
+            case 'x':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-x: Must specify a font before specifying metrics.");
+                temp_n = (int)strtol(optarg, NULL, 0);
+                if (temp_n < 0)
+                    throw_error(bad_options, "-x: Number too large or small.");
+                current_input->x_height = temp_n;
+                break;
+            case 'l':
+                if (current_input == NULL)
+                    throw_error(bad_options, "-l: Must specify a font before specifying metrics.");
+                temp_n = (int)strtol(optarg, NULL, 0);
+                if (temp_n < 0)
+                    throw_error(bad_options, "-l: Number too large or small.");
+                current_input->baseline_height = temp_n;
+                break;
+            case 'N':
+                if (!any_fontpack(job))
+                    throw_error(bad_options, "-N: Must specify font pack output format.");
+                if (job->metadata.name != NULL)
+                    throw_error(bad_options, "-N: Duplicate.");
+                if ((strl = strlen(optarg)) >= 4096)
+                    throw_error(bad_options, "-N: Way too long a string!");
+                else if (strl > 255)
+                    printf("-N: Recommend against such a long string.\n");
+                job->metadata.name = optarg;
+                break;
+            case 'A':
+                if (!any_fontpack(job))
+                    throw_error(bad_options, "-A: Must specify font pack output format.");
+                if (job->metadata.author != NULL)
+                    throw_error(bad_options, "-A: Duplicate.");
+                if ((strl = strlen(optarg)) >= 4096)
+                    throw_error(bad_options, "-A: Way too long a string!");
+                else if (strl > 255)
+                    printf("-A: Recommend against such a long string.  You are not an aristocrat.\n");
+                job->metadata.author = optarg;
+                break;
+            case 'C':
+                if (!any_fontpack(job))
+                    throw_error(bad_options, "-C: Must specify font pack output format.");
+                if (job->metadata.pseudocopyright != NULL)
+                    throw_error(bad_options, "-C: Duplicate.");
+                if (strlen(optarg) > 255)
+                    throw_error(bad_options, "-C: Screw the copyright lawyers.  You don't need such a long copyright string.\n");
+                job->metadata.pseudocopyright = optarg;
+                break;
+            case 'D':
+                if (!any_fontpack(job))
+                    throw_error(bad_options, "-D: Must specify font pack output format.");
+                if (job->metadata.description != NULL)
+                    throw_error(bad_options, "-D: Duplicate.");
+                if ((strl = strlen(optarg)) >= 4096)
+                    throw_error(bad_options, "-D: Way too long a string!");
+                else if (strl > 255)
+                    printf("-D: Recommend against such a long string.  (It's called the \"description\" field, not \"dissertation\"!)\n");
+                job->metadata.description = optarg;
+                break;
+            case 'V':
+                if (!any_fontpack(job))
+                    throw_error(bad_options, "-V: Must specify font pack output format.");
+                if (job->metadata.version != NULL)
+                    throw_error(bad_options, "-V: Duplicate.");
+                if ((strl = strlen(optarg)) >= 4096)
+                    throw_error(bad_options, "-V: Way too long a string!");
+                else if (strl > 255)
+                    printf("-V: Recommend against such a long string.  (It's called the version field, not the changelog!)\n");
+                job->metadata.version = optarg;
+                break;
+            case 'P':
+                if (!any_fontpack(job))
+                    throw_error(bad_options, "-P: Must specify font pack output format.");
+                if (job->metadata.codepage != NULL)
+                    throw_error(bad_options, "-P: Duplicate.");
+                if (strlen(optarg) > 255)
+                    printf("-P: Strongly recommend against such a long string.  (What, are you trying to embed a complete Unicode translation table?)\n");
+                job->metadata.codepage = optarg;
+                break;
+            case '?':
+                throw_error(bad_options, "Unknown option; check syntax.");
+                break;
+        }
+    }
+
+    if (job->output_count == 0)
+        throw_error(bad_options, "-o: No output format specified.");
+    /* Every output without a file name of its own goes to the one given last,
+     * so there can only be one. */
+    job_output_t *unnamed = NULL;
+    for (int i = 0; i < job->output_count; i++)
+        if (job->outputs[i].file_name == NULL) {
+            if (unnamed != NULL)
+                throw_error(bad_options, "-o: Only one output can go to the last parameter; use -o format=file for the others.");
+            unnamed = &job->outputs[i];
+        }
+    if (unnamed != NULL) {
+        if (optind == argc)
+            throw_error(bad_options, "Last parameter must be output file name; none was given.");
+        unnamed->file_name = argv[optind++];
+    }
+    if (optind < argc)
+        throw_error(bad_options, "Too many trailing parameters.");
+    if (job->input_count == 0)
+        throw_error(bad_options, "No input font(s) given. . . . Nothing to do.");
+    if (job->input_count > 1 && !only_fontpacks(job))
+        throw_error(bad_options, "-o: Only font packs can have multiple input fonts.");
+    if (job->split_fontpack && !any_fontpack(job))
+        throw_error(bad_options, "-S: Must specify font pack output format.");
+    if (job->appvar_name != NULL && !any_appvar(job))
+        throw_error(bad_options, "-n: Must specify appvar output format.");
+    return true;
+}
+
+
+
+/*******************************************************************************
+*                                   INPUT                                      *
+*******************************************************************************/
+
+/* Applies an input's metrics to a font loaded from it. */
+static void apply_metrics(const job_input_t *input, fontlib_font_t *font) {
+    if (input->space_above >= 0)
+        font->space_above = (uint8_t)input->space_above;
+    if (input->space_below >= 0)
+        font->space_below = (uint8_t)input->space_below;
+    if (input->italic_space_adjust >= 0)
+        font->italic_space_adjust = (uint8_t)input->italic_space_adjust;
+    if (input->weight >= 0)
+        font->weight = (uint8_t)input->weight;
+    font->style |= input->style;
+    if (input->cap_height >= 0) {
+        if (input->cap_height > font->height)
+            throw_error(bad_options, "-c: Number too large or small.");
+        font->cap_height = (uint8_t)input->cap_height;
+    }
+    if (input->x_height >= 0) {
+        if (input->x_height > font->height)
+            throw_error(bad_options, "-x: Number too large or small.");
+        font->x_height = (uint8_t)input->x_height;
+    }
+    if (input->baseline_height >= 0) {
+        if (input->baseline_height > font->height)
+            throw_error(bad_options, "-l: Number too large or small.");
+        font->baseline_height = (uint8_t)input->baseline_height;
+    }
+}
+
+/* Does the actual work of parse_input_file(). */
+static int parse_opened_file(job_input_t *input, FILE *in_file, fontlib_font_t **fonts, int max_fonts) {
+    switch (input->type) {
+        case input_fnt: {
+            int ver = read_word(in_file);
+            if (ver != 0x200 && ver != 0x300)
+                throw_error(bad_infile, "-f: Input file does not appear to be an FNT at all.");
+            fonts[0] = parse_fnt(in_file, 0);
+            return 1;
+        }
+        case input_fon:
+            return parse_fon(in_file, fonts, max_fonts);
+        case input_text:
+            fonts[0] = parse_text(in_file, 0);
+            return 1;
+    }
+    throw_error(internal_error, "parse_input_file: Unknown input type.");
+}
+
+/* Parses an opened input file.  Jobs run on in batch and server mode after
+ * an error, so the file is closed if the parser throws.
+ * @return Number of fonts parsed. */
+static int parse_input_file(job_input_t *input, FILE *in_file, fontlib_font_t **fonts, int max_fonts) {
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        int count = parse_opened_file(input, in_file, fonts, max_fonts);
+        pop_error_trap(&trap);
+        return count;
+    }
+    fclose(in_file);
+    rethrow_error(&trap);
+}
+
+/* Like parse_input_file(), for an input sent inline. */
+static int parse_input_data(job_input_t *input, const memory_file_t *file, fontlib_font_t **fonts, int max_fonts) {
+    switch (input->type) {
+        case input_fnt: {
+            int ver = file->size < 2 ? 0 : file->data[0] | (file->data[1] << 8);
+            if (ver != 0x200 && ver != 0x300)
+                throw_error(bad_infile, "-f: Input file does not appear to be an FNT at all.");
+            fonts[0] = parse_fnt_buffer(file->data, file->size, 0);
+            return 1;
+        }
+        case input_fon:
+            return parse_fon_buffer(file->data, file->size, fonts, max_fonts);
+        case input_text:
+            fonts[0] = parse_text_buffer(file->data, file->size, 0);
+            return 1;
+    }
+    throw_error(internal_error, "parse_input_data: Unknown input type.");
+}
+
+/* Finds an input the job was sent inline.
+ * @return NULL if it wasn't, and should be read from the filesystem. */
+static const memory_file_t *find_memory_input(conversion_job_t *job, const char *file_name) {
+    if (job->memory_files == NULL)
+        return NULL;
+    for (int i = 0; i < job->memory_files->input_count; i++)
+        if (!strcmp(job->memory_files->inputs[i].name, file_name))
+            return &job->memory_files->inputs[i];
+    return NULL;
+}
+
+/* Works out where to open an input file.  Only --serve sets an input
+ * directory, and it doesn't run on Windows, so only / starts an absolute path.
+ * @param path Space for the whole path, if it has to be put together.
+ * @return The name to pass to fopen(). */
+static const char *input_path(conversion_job_t *job, job_input_t *input, char path[FILENAME_MAX]) {
+    if (job->input_directory == NULL || input->file_name[0] == '/')
+        return input->file_name;
+    if (snprintf(path, FILENAME_MAX, "%s/%s", job->input_directory, input->file_name) >= FILENAME_MAX)
+        throw_errorf(bad_infile, "%s: Input file name too long.", input->type == input_fon ? "-F" : "-f");
+    return path;
+}
+
+/* Reads one input's fonts from wherever is quickest: memory, then a snapshot,
+ * then the source itself.
+ * @return Number of fonts loaded. */
+static int load_input(conversion_job_t *job, job_input_t *input, fontlib_font_t **fonts, int max_fonts) {
+    const memory_file_t *data = find_memory_input(job, input->file_name);
+    char path_buffer[FILENAME_MAX];
+    const char *path = data == NULL ? input_path(job, input, path_buffer) : NULL;
+    FILE *in_file;
+    int count = -1;
+    if (job->snapshot_memory != NULL) {
+        if (data != NULL)
+            count = recall_snapshot_data(job->snapshot_memory, data->data, data->size, input->type, fonts, max_fonts);
+        else
+            count = recall_snapshot(job->snapshot_memory, path, input->type, fonts, max_fonts);
+        if (count > 0) {
+            if (verbosity >= 1)
+                printf("Loaded %i font(s) from memory.\n", count);
+            return count;
+        }
+    }
+    if (job->snapshots && path != NULL) {
+        count = load_snapshot(path, input->type, fonts, max_fonts);
+        if (count > 0 && verbosity >= 1)
+            printf("Loaded %i font(s) from snapshot.\n", count);
+    }
+    if (count <= 0) {
+        if (data != NULL)
+            count = parse_input_data(input, data, fonts, max_fonts);
+        else {
+            in_file = fopen(path, input->type == input_text ? "r" : "rb");
+            if (!in_file)
+                throw_errorf(bad_infile, "%s: Cannot open input file.", input->type == input_fon ? "-F" : "-f");
+            count = parse_input_file(input, in_file, fonts, max_fonts);
+            fclose(in_file);
+        }
+        if (input->type == input_fon && verbosity >= 1)
+            printf("Loaded %i font(s) from FON.\n", count);
+        /* Metrics haven't been applied yet, so the snapshot suits any. */
+        if (job->snapshots && path != NULL && !save_snapshot(path, input->type, fonts, count) && verbosity >= 1)
+            printf("-u: Could not save a snapshot of %s.\n", input->file_name);
+    }
+    if (job->snapshot_memory != NULL) {
+        if (data != NULL)
+            remember_snapshot_data(job->snapshot_memory, data->data, data->size, input->type, fonts, count);
+        else
+            remember_snapshot(job->snapshot_memory, path, input->type, fonts, count);
+    }
+    return count;
+}
+
+void load_job_fonts(conversion_job_t *job) {
+    int first;
+
+    for (int n = 0; n < job->input_count; n++) {
+        job_input_t *input = &job->inputs[n];
+        if (verbosity >= 1)
+            printf("Processing input file %s . . .\n", input->file_name);
+        /* A .fon can fill up the table on its own, so this has to be checked
+         * for every input, not just counted when parsing the options. */
+        if (job->fonts_loaded >= MAX_FONTS - 1)
+            throw_error(bad_options, "Too many fonts.  What on Earth makes you think your font pack needs so many fonts?");
+        first = job->fonts_loaded;
+        job->fonts_loaded += load_input(job, input, job->fonts + first, MAX_FONTS - 1 - first);
+        if (job->fonts_loaded - first > 1 && !only_fontpacks(job))
+            throw_error(bad_options, "-F: FON contains multiple fonts; -o fontpack must be specified first.");
+        for (int i = first; i < job->fonts_loaded; i++) {
+            apply_metrics(input, job->fonts[i]);
+            job->font_inputs[i] = n;
+        }
+    }
+}
+
+void free_job(conversion_job_t *job) {
+    for (int i = 0; i < job->fonts_loaded; i++) {
+        if (job->fonts[i] != NULL)
+            free_fnt(job->fonts[i]);
+        job->fonts[i] = NULL;
+    }
+    job->fonts_loaded = 0;
+}
+
+
+
+/*******************************************************************************
+*                                   OUTPUT                                     *
+*******************************************************************************/
+
+/* Serialized forms of a set of fonts, built the first time an output needs
+ * them and then shared by every other output that can use them. */
+typedef struct {
+    fontlib_font_t **fonts;
+    int count;
+    /* The last font on its own, for binary and C array output. */
+    uint8_t *font_image;
+    size_t font_size;
+    int font_saved;
+    /* All of the fonts as a font pack, for font pack and appvar output. */
+    uint8_t *pack_image;
+    size_t pack_size;
+    int pack_saved;
+} job_images_t;
+
+static void free_job_images(job_images_t *images) {
+    free(images->font_image);
+    images->font_image = NULL;
+    free(images->pack_image);
+    images->pack_image = NULL;
+}
+
+/* Does the actual work of write_output_file(). */
+static void write_job_file(conversion_job_t *job, job_output_t *output, job_images_t *images, const char *appvar_name, FILE *out_file) {
+    fontlib_font_t *current_font = images->fonts[images->count - 1];
+    uint8_t *appvar;
+    size_t size;
+    size_t pack_size = 0;
+    int saved = 0;
+    if (output->format == output_fontpack && !output->assembly && images->pack_image == NULL)
+        images->pack_image = build_fontpack_image(images->fonts, images->count, &job->metadata, job->packing, &images->pack_size, &images->pack_saved);
+    if ((output->format == output_c_array || output->format == output_binary_blob) && images->font_image == NULL)
+        images->font_image = build_font_image(current_font, job->packing, &images->font_size, &images->font_saved);
+    switch (output->format) {
+        case output_fontpack:
+            if (output->assembly) {
+                pack_size = write_asm_fontpack(out_file, images->fonts, images->count, &job->metadata, job->packing, job->unix_newline_style);
+                break;
+            }
+            pack_size = images->pack_size;
+            saved = images->pack_saved;
+            if (output->appvar) {
+                appvar = build_appvar_file(images->pack_image, pack_size, appvar_name, output->archived, &size);
+                fwrite(appvar, 1, size, out_file);
+                free(appvar);
+            } else
+                fwrite(images->pack_image, 1, pack_size, out_file);
+            break;
+        case output_c_array:
+            format_c_array(images->font_image, images->font_size, job->unix_newline_style, output_file_span, out_file);
+            saved = images->font_saved;
+            break;
+        case output_asm_array:
+            write_asm_font(out_file, current_font, job->packing, job->unix_newline_style);
+            break;
+        case output_binary_blob:
+            fwrite(images->font_image, 1, images->font_size, out_file);
+            saved = images->font_saved;
+            break;
+        default:
+            throw_error(internal_error, "-o: Someone attempted to add a new output format without actually coding it.");
+            break;
+    }
+    if (saved > 0)
+        printf("Bitmap packing saved %i bytes.\n", saved);
+    if (output->format == output_fontpack)
+        printf("Font pack uses %i of the %i bytes an appvar can hold.\n", (int)pack_size, MAX_APPVAR_SIZE - 1);
+    printf("Output size: %li bytes; conversion finished.\n", ftell(out_file));
+}
+
+/* Starts writing one of a job's files, which goes to memory instead if the
+ * job keeps its files there.
+ * @return false if the file couldn't be opened. */
+static bool open_job_file(conversion_job_t *job, const char *file_name, output_file_t *output) {
+    if (job->memory_files == NULL)
+        return open_output_file(file_name, output);
+    if (job->memory_files->output_count >= MAX_JOB_FILES)
+        return false;
+    output->name = NULL;
+    output->temporary = NULL;
+    output->file = tmpfile();
+    return output->file != NULL;
+}
+
+/* Finishes writing one of a job's files.  One going to memory always counts
+ * as replaced, since it isn't compared with anything. */
+static output_result_t close_job_file(conversion_job_t *job, const char *file_name, output_file_t *output) {
+    if (job->memory_files == NULL)
+        return close_output_file(output);
+    memory_file_t *file = &job->memory_files->outputs[job->memory_files->output_count];
+    FILE *in_file = output->file;
+    long size = ftell(in_file);
+    file->name = malloc(strlen(file_name) + 1);
+    file->data = malloc(size > 0 ? (size_t)size : 1);
+    file->size = size > 0 ? (size_t)size : 0;
+    rewind(in_file);
+    if (size < 0 || ferror(in_file) || file->name == NULL || file->data == NULL
+            || fread(file->data, 1, file->size, in_file) != file->size) {
+        free(file->name);
+        free(file->data);
+        fclose(in_file);
+        return output_failed;
+    }
+    fclose(in_file);
+    strcpy(file->name, file_name);
+    job->memory_files->output_count++;
+    return output_replaced;
+}
+
+/* Abandons writing one of a job's files. */
+static void discard_job_file(conversion_job_t *job, output_file_t *output) {
+    if (job->memory_files == NULL)
+        discard_output_file(output);
+    else
+        fclose(output->file);
+}
+
+void free_job_files(job_files_t *files) {
+    for (int i = 0; i < files->output_count; i++) {
+        free(files->outputs[i].name);
+        free(files->outputs[i].data);
+    }
+    files->output_count = 0;
+}
+
+/* Writes fonts to one output file.  The file is only replaced once it has been
+ * written in full, and not at all if it comes out the same as before; if an
+ * error is thrown, whatever was there before is left alone.
+ * @return output_replaced or output_unchanged. */
+static output_result_t write_output_file(conversion_job_t *job, job_output_t *output, const char *file_name, const char *appvar_name, job_images_t *images) {
+    output_file_t out_file;
+    if (!open_job_file(job, file_name, &out_file))
+        throw_error(bad_outfile, "Cannot open output file.");
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        write_job_file(job, output, images, appvar_name, out_file.file);
+        pop_error_trap(&trap);
+    } else {
+        discard_job_file(job, &out_file);
+        rethrow_error(&trap);
+    }
+    output_result_t result = close_job_file(job, file_name, &out_file);
+    switch (result) {
+        case output_failed:
+            throw_error(bad_outfile, "Cannot write output file.");
+            break;
+        case output_unchanged:
+            if (verbosity >= 1)
+                printf("%s is unchanged, so it was left alone.\n", file_name);
+            break;
+        default:
+            break;
+    }
+    return result;
+}
+
+/* Finds where a file name's extension starts, or its end if it has none. */
+static const char *find_extension(const char *file_name) {
+    const char *extension = strrchr(file_name, '.');
+    const char *slash = strrchr(file_name, '/');
+    const char *backslash = strrchr(file_name, '\\');
+    if (backslash > slash)
+        slash = backslash;
+    if (extension == NULL || extension < slash)
+        return file_name + strlen(file_name);
+    return extension;
+}
+
+/* Works out what to call the appvar an output is written as: the name given
+ * with -n, or else the output file's name without its directory or extension.
+ * @param number For one of the packs of a split font pack, the number of the
+ * pack, which is added to the end of the name; otherwise 0.
+ * @param name Receives the name, which is empty if the output isn't an
+ * appvar. */
+static void make_appvar_name(conversion_job_t *job, job_output_t *output, int number, char name[MAX_APPVAR_NAME_LENGTH + 1]) {
+    const char *base = job->appvar_name;
+    int length;
+    name[0] = '\0';
+    if (!output->appvar)
+        return;
+    if (base == NULL) {
+        const char *slash = strrchr(output->file_name, '/');
+        const char *backslash = strrchr(output->file_name, '\\');
+        base = output->file_name;
+        if (slash != NULL)
+            base = slash + 1;
+        if (backslash != NULL && backslash + 1 > base)
+            base = backslash + 1;
+    }
+    /* number is at most MAX_FONTS, so it never takes the whole name. */
+    char digits[4] = "";
+    int digit_count = number > 0 ? snprintf(digits, sizeof(digits), "%i", number % 1000) : 0;
+    length = (int)(find_extension(base) - base);
+    if (length > MAX_APPVAR_NAME_LENGTH - digit_count)
+        length = MAX_APPVAR_NAME_LENGTH - digit_count;
+    memcpy(name, base, length);
+    memcpy(name + length, digits, digit_count + 1);
+    check_appvar_name(name);
+}
+
+/* Makes the name of one of the files a split font pack is written to by adding
+ * _number to the output file name, before its extension if it has one.
+ * @return A malloc()ed string. */
+static char *split_file_name(const char *file_name, int number) {
+    const char *extension = find_extension(file_name);
+    size_t length = strlen(file_name) + 16;
+    char *name = malloc(length);
+    if (name == NULL)
+        throw_error(malloc_failed, "-S: Failed to malloc file name.");
+    snprintf(name, length, "%.*s_%i%s", (int)(extension - file_name), file_name, number, extension);
+    return name;
+}
+
+/* The files written for a split font pack so far.  This is only ever changed
+ * through a pointer, so it's still good after an error longjmp()s out. */
+typedef struct {
+    char *names[MAX_FONTS * MAX_OUTPUTS];
+    /* Whether each file was replaced, rather than left as it was. */
+    bool replaced[MAX_FONTS * MAX_OUTPUTS];
+    int name_count;
+    int written;
+    /* The fonts of every pack, one pack after another. */
+    fontlib_font_t *members[MAX_FONTS];
+    job_images_t images[MAX_FONTS];
+} split_files_t;
+
+/* Does the actual work of write_split_fontpack().  Every pack is built before
+ * any is written, so that finding one doesn't fit leaves no files changed. */
+static void write_split_packs(conversion_job_t *job, const int *packs, int pack_count, split_files_t *files) {
+    char appvar_names[MAX_OUTPUTS][MAX_APPVAR_NAME_LENGTH + 1];
+    int member_count = 0;
+    for (int p = 0; p < pack_count; p++) {
+        job_images_t *images = &files->images[p];
+        images->fonts = files->members + member_count;
+        for (int i = 0; i < job->fonts_loaded; i++)
+            if (packs[i] == p)
+                files->members[member_count++] = job->fonts[i];
+        images->count = (int)(files->members + member_count - images->fonts);
+        images->pack_image = build_fontpack_image_if_fits(images->fonts, images->count, &job->metadata, job->packing, &images->pack_size, &images->pack_saved);
+        if (images->pack_image == NULL)
+            throw_error(bad_options, "Cannot split font pack; fonts don't fit together as planned.  Try -p dedup.");
+    }
+    for (int p = 0; p < pack_count; p++) {
+        int first_name = files->name_count;
+        for (int o = 0; o < job->output_count; o++) {
+            job_output_t *output = &job->outputs[o];
+            if (output->format != output_fontpack)
+                continue;
+            files->names[files->name_count] = split_file_name(output->file_name, p + 1);
+            make_appvar_name(job, output, p + 1, appvar_names[o]);
+            if (verbosity >= 1) {
+                printf(files->name_count > first_name ? ", %s" : "%s", files->names[files->name_count]);
+                if (output->appvar)
+                    printf(" (appvar %s)", appvar_names[o]);
+            }
+            files->name_count++;
+        }
+        if (verbosity >= 1) {
+            printf(":\n");
+            for (int i = 0; i < job->fonts_loaded; i++)
+                if (packs[i] == p)
+                    printf("\tfont %i from %s, height %i\n", i + 1, job->inputs[job->font_inputs[i]].file_name, job->fonts[i]->height);
+        }
+        for (int o = 0; o < job->output_count; o++)
+            if (job->outputs[o].format == output_fontpack) {
+                int n = files->written;
+                files->replaced[n] = write_output_file(job, &job->outputs[o], files->names[n], appvar_names[o], &files->images[p]) == output_replaced;
+                files->written++;
+            }
+    }
+}
+
+/* Writes a font pack too big for one appvar to as few packs as possible, in
+ * every font pack format asked for, printing which font went where with -v.
+ * If anything goes wrong, every file this replaced is removed, so that no
+ * pack is left over from a mix of old and new. */
+static void write_split_fontpack(conversion_job_t *job) {
+    int packs[MAX_FONTS];
+    split_files_t files;
+    memset(&files, 0, sizeof(split_files_t));
+    int pack_count = split_fontpack(job->fonts, job->fonts_loaded, &job->metadata, job->packing, packs);
+    if (verbosity >= 1)
+        printf("Font pack is too big for one appvar; splitting it into %i font packs.\n", pack_count);
+    job->split_count = pack_count;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        write_split_packs(job, packs, pack_count, &files);
+        pop_error_trap(&trap);
+    } else {
+        for (int p = 0; p < pack_count; p++)
+            free_job_images(&files.images[p]);
+        /* Files written to memory are thrown away with the rest of the
+         * job's. */
+        for (int i = 0; i < files.written; i++)
+            if (files.replaced[i] && job->memory_files == NULL)
+                remove(files.names[i]);
+        for (int i = 0; i < files.name_count; i++)
+            free(files.names[i]);
+        rethrow_error(&trap);
+    }
+    for (int p = 0; p < pack_count; p++)
+        free_job_images(&files.images[p]);
+    for (int i = 0; i < files.name_count; i++)
+        free(files.names[i]);
+}
+
+/* Does the actual work of write_job_output(). */
+static void write_job_outputs(conversion_job_t *job, job_images_t *images) {
+    char appvar_name[MAX_APPVAR_NAME_LENGTH + 1];
+    /* With -S, the font pack was built up front, unless it didn't fit. */
+    bool split = job->split_fontpack && images->pack_image == NULL;
+    for (int i = 0; i < job->output_count; i++) {
+        job_output_t *output = &job->outputs[i];
+        if (split && output->format == output_fontpack)
+            continue;
+        make_appvar_name(job, output, 0, appvar_name);
+        if (job->output_count > 1 && verbosity >= 1)
+            printf("%s:\n", output->file_name);
+        write_output_file(job, output, output->file_name, appvar_name, images);
+    }
+    if (split)
+        write_split_fontpack(job);
+}
+
+void write_job_output(conversion_job_t *job) {
+    job_images_t images = { job->fonts, job->fonts_loaded, NULL, 0, 0, NULL, 0, 0 };
+    /* Packing bitmaps is the slow part, so the font pack that shows whether
+     * -S has to split anything is the one that gets written. */
+    if (job->split_fontpack)
+        images.pack_image = build_fontpack_image_if_fits(job->fonts, job->fonts_loaded, &job->metadata, job->packing, &images.pack_size, &images.pack_saved);
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        write_job_outputs(job, &images);
+        pop_error_trap(&trap);
+    } else {
+        free_job_images(&images);
+        rethrow_error(&trap);
+    }
+    free_job_images(&images);
+}
+
+
+/*******************************************************************************
+*                                DEPENDENCIES                                  *
+*******************************************************************************/
+
+/* Writes a file name, or the first length characters of one, the way make
+ * reads it.  Backslashes are left alone, as they're how Windows paths are
+ * written. */
+static void put_make_name(FILE *file, const char *name, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (name[i] == ' ' || name[i] == '#')
+            fputc('\\', file);
+        else if (name[i] == '$')
+            fputc('$', file);
+        fputc(name[i], file);
+    }
+}
+
+/* Whether an input's file was already given by an earlier input. */
+static bool repeated_input(conversion_job_t *job, int index) {
+    for (int i = 0; i < index; i++)
+        if (strcmp(job->inputs[i].file_name, job->inputs[index].file_name) == 0)
+            return true;
+    return false;
+}
+
+/* Writes the make rule for -M, which has every output file a job wrote
+ * depending on every input file it read, as cc -MD -MP does.  Each input also
+ * gets an empty rule of its own, so deleting a font doesn't stop make. */
+static void write_dependency_file(conversion_job_t *job) {
+    output_file_t output;
+    if (!open_job_file(job, job->dependency_file_name, &output))
+        throw_error(bad_outfile, "-M: Cannot open dependency file.");
+    FILE *file = output.file;
+    for (int i = 0; i < job->output_count; i++) {
+        const char *name = job->outputs[i].file_name;
+        if (i > 0)
+            fputc(' ', file);
+        if (job->split_count == 0 || job->outputs[i].format != output_fontpack) {
+            put_make_name(file, name, strlen(name));
+            continue;
+        }
+        /* The same names as split_file_name() gives. */
+        const char *extension = find_extension(name);
+        for (int p = 1; p <= job->split_count; p++) {
+            if (p > 1)
+                fputc(' ', file);
+            put_make_name(file, name, extension - name);
+            fprintf(file, "_%i", p);
+            put_make_name(file, extension, strlen(extension));
+        }
+    }
+    fputc(':', file);
+    for (int i = 0; i < job->input_count; i++)
+        if (!repeated_input(job, i)) {
+            fputs(" \\\n ", file);
+            put_make_name(file, job->inputs[i].file_name, strlen(job->inputs[i].file_name));
+        }
+    fputc('\n', file);
+    for (int i = 0; i < job->input_count; i++)
+        if (!repeated_input(job, i)) {
+            fputc('\n', file);
+            put_make_name(file, job->inputs[i].file_name, strlen(job->inputs[i].file_name));
+            fputs(":\n", file);
+        }
+    if (close_job_file(job, job->dependency_file_name, &output) == output_failed)
+        throw_error(bad_outfile, "-M: Cannot write dependency file.");
+}
+
+
+/*******************************************************************************
+*                                   CACHE                                      *
+*******************************************************************************/
+
+/* Works out the cache key of each of a job's outputs, from every input file
+ * and every option that affects what the output holds.
+ * @return false if an input couldn't be read, in which case the job should
+ * just be run so that the problem is reported properly. */
+static bool make_cache_keys(conversion_job_t *job, uint64_t keys[MAX_OUTPUTS]) {
+    const fontpack_metadata_t *metadata = &job->metadata;
+    uint64_t key = start_cache_key();
+    key = hash_cache_int(key, job->packing);
+    key = hash_cache_int(key, job->unix_newline_style);
+    key = hash_cache_string(key, metadata->name);
+    key = hash_cache_string(key, metadata->author);
+    key = hash_cache_string(key, metadata->pseudocopyright);
+    key = hash_cache_string(key, metadata->description);
+    key = hash_cache_string(key, metadata->version);
+    key = hash_cache_string(key, metadata->codepage);
+    key = hash_cache_int(key, job->input_count);
+    for (int i = 0; i < job->input_count; i++) {
+        job_input_t *input = &job->inputs[i];
+        key = hash_cache_int(key, input->type);
+        key = hash_cache_int(key, input->space_above);
+        key = hash_cache_int(key, input->space_below);
+        key = hash_cache_int(key, input->italic_space_adjust);
+        key = hash_cache_int(key, input->weight);
+        key = hash_cache_int(key, input->cap_height);
+        key = hash_cache_int(key, input->x_height);
+        key = hash_cache_int(key, input->baseline_height);
+        key = hash_cache_int(key, input->style);
+        if (!hash_cache_file(&key, input->file_name))
+            return false;
+    }
+    for (int i = 0; i < job->output_count; i++) {
+        job_output_t *output = &job->outputs[i];
+        char appvar_name[MAX_APPVAR_NAME_LENGTH + 1];
+        make_appvar_name(job, output, 0, appvar_name);
+        keys[i] = hash_cache_int(key, output->format);
+        keys[i] = hash_cache_int(keys[i], output->appvar);
+        keys[i] = hash_cache_int(keys[i], output->archived);
+        keys[i] = hash_cache_int(keys[i], output->assembly);
+        keys[i] = hash_cache_string(keys[i], appvar_name);
+    }
+    return true;
+}
+
+void run_job(conversion_job_t *job) {
+    uint64_t keys[MAX_OUTPUTS];
+    bool cached = false;
+    bool found = false;
+    verbosity = job->verbosity;
+    if (job->cache_directory != NULL) {
+        /* A split font pack's files depend on how the split comes out. */
+        if (job->split_fontpack) {
+            if (verbosity >= 1)
+                printf("-k: Font packs split with -S are not cached.\n");
+        } else
+            cached = make_cache_keys(job, keys);
+    }
+    if (cached) {
+        found = true;
+        for (int i = 0; i < job->output_count && found; i++)
+            found = in_cache(job->cache_directory, keys[i]);
+        if (found) {
+            for (int i = 0; i < job->output_count; i++) {
+                fetch_from_cache(job->cache_directory, keys[i], job->outputs[i].file_name);
+                if (verbosity >= 1)
+                    printf("%s: copied from cache.\n", job->outputs[i].file_name);
+            }
+            job->cache_hits += job->output_count;
+        }
+    }
+    if (!found) {
+        load_job_fonts(job);
+        write_job_output(job);
+    }
+    if (cached && !found) {
+        for (int i = 0; i < job->output_count; i++)
+            if (!store_in_cache(job->cache_directory, keys[i], job->outputs[i].file_name) && verbosity >= 1)
+                printf("-k: Could not add %s to the cache.\n", job->outputs[i].file_name);
+        job->cache_misses += job->output_count;
+    }
+    if (job->dependency_file_name != NULL)
+        write_dependency_file(job);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "image.h"
+#include "pack_bitmaps.h"
+#include "snapshot.h"
+
+#define MAX_FONTS 64
+
+typedef enum {
+    input_fnt,
+    input_fon,
+    input_text,
+} input_types_t;
+
+/* One -f, -F, or -t input, along with the metrics given after it.  Metrics
+ * are -1 if they were not specified and the font's own value should stand. */
+typedef struct {
+    input_types_t type;
+    char *file_name;
+    int space_above;
+    int space_below;
+    int italic_space_adjust;
+    int weight;
+    int cap_height;
+    int x_height;
+    int baseline_height;
+    /* -s options are ORed into the style field, so this starts at zero. */
+    uint8_t style;
+} job_input_t;
+
+#define MAX_OUTPUTS 8
+
+/* One -o output. */
+typedef struct {
+    output_formats_t format;
+    /* Whether a font pack is written as a .8xv file instead of raw, and if
+     * so, whether it goes to archive. */
+    bool appvar;
+    bool archived;
+    /* Whether a font pack is written as assembly source instead. */
+    bool assembly;
+    /* From -o format=path, or else the file name given last on the command
+     * line. */
+    char *file_name;
+} job_output_t;
+
+/* A file held in memory: an input sent to --serve inline with a request, or
+ * one of the files a job run there sends back instead of writing. */
+typedef struct {
+    char *name;
+    uint8_t *data;
+    size_t size;
+} memory_file_t;
+
+/* Every output, split into as many packs as -S allows, plus the -M file. */
+#define MAX_JOB_FILES (MAX_OUTPUTS * MAX_FONTS + 1)
+
+/* The files of a job that reads and writes memory instead of the filesystem. */
+typedef struct {
+    /* Inputs that are read from here instead of from the file they name,
+     * matched by name.  The job doesn't own these. */
+    int input_count;
+    const memory_file_t *inputs;
+    /* Each file the job wrote, in the order it wrote them.  Release these
+     * with free_job_files(). */
+    int output_count;
+    memory_file_t outputs[MAX_JOB_FILES];
+} job_files_t;
+
+/* Everything needed to produce a set of output files from the same fonts.
+ * Jobs share no state, so several can be loaded and written at the same time
+ * on different threads. */
+typedef struct {
+    int output_count;
+    job_output_t outputs[MAX_OUTPUTS];
+    bool unix_newline_style;
+    bitmap_packing_t packing;
+    /* How much to print, from -v.  run_job() gives the thread this
+     * verbosity, so jobs parsed together don't add up each other's. */
+    int verbosity;
+    /* Whether a font pack too big for one appvar is split into several. */
+    bool split_fontpack;
+    /* How many packs a split font pack came out as, or 0 if it wasn't. */
+    int split_count;
+    /* What appvars are called.  NULL means each is named after its file. */
+    char *appvar_name;
+    /* Whether parsed fonts are saved as snapshots beside their sources, and
+     * loaded from there when the source hasn't changed. */
+    bool snapshots;
+    /* Fonts parsed by earlier jobs in the same process, which --serve keeps
+     * in memory, or NULL. */
+    snapshot_memory_t *snapshot_memory;
+    /* Directory that relative input file names are found in, or NULL for
+     * the working directory.  --serve reads from the client's directory this
+     * way, instead of changing the whole process's. */
+    const char *input_directory;
+    /* Where the job reads and writes files instead of the filesystem, or
+     * NULL to use the filesystem. */
+    job_files_t *memory_files;
+    /* Directory of cached outputs given with -k, or NULL to not cache. */
+    char *cache_directory;
+    /* Where -M writes a make rule giving the inputs each output depends on,
+     * or NULL to not write one. */
+    char *dependency_file_name;
+    /* How many outputs were copied from the cache, and how many had to be
+     * converted and were then added to it. */
+    int cache_hits;
+    int cache_misses;
+    fontpack_metadata_t metadata;
+    int input_count;
+    job_input_t inputs[MAX_FONTS];
+    int fonts_loaded;
+    fontlib_font_t *fonts[MAX_FONTS];
+    /* Which of inputs each font came from. */
+    int font_inputs[MAX_FONTS];
+} conversion_job_t;
+
+/* Sets a job to its defaults: no inputs, no outputs, overlap packing, and
+ * the platform's native newline style. */
+void init_job(conversion_job_t *job);
+
+/* Fills in a job from a convfont command line.  No files are opened; that is
+ * left for load_job_fonts().  getopt() is not reentrant, so this must not be
+ * called from more than one thread at a time.  Strings in argv are referenced
+ * by the job, not copied.
+ * @param job The job to fill in, which should have been passed to init_job().
+ * @param argc Number of arguments, including the program name.
+ * @param argv The arguments, starting with the program name.
+ * @return false if -h was given, in which case nothing else was parsed. */
+bool parse_job_options(conversion_job_t *job, int argc, char *argv[]);
+
+/* Reads every input font of a job and applies its metrics. */
+void load_job_fonts(conversion_job_t *job);
+
+/* Writes a job's loaded fonts to each of its output files.  The fonts are
+ * only serialized once for all the outputs that can share it.  If an error is
+ * thrown, no output is left half-written.  A font pack split by -S
+ * goes to several files named after the output file, e.g. pack_1.bin,
+ * pack_2.bin. */
+void write_job_output(conversion_job_t *job);
+
+/* Does all of a job: loads its fonts and writes its outputs.  If the job has
+ * a cache directory and every output is already in it, they're just copied
+ * from there instead; otherwise the new outputs are added to it.  Last, if
+ * the job asks for one, its dependency file is written.
+ * @param job The job to run, which should have been passed to
+ * parse_job_options(). */
+void run_job(conversion_job_t *job);
+
+/* Releases any fonts still held by a job. */
+void free_job(conversion_job_t *job);
+
+/* Releases the files a job wrote to memory.  The inputs are left alone. */
+void free_job_files(job_files_t *files);
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "c_array.h"
+#include "image.h"
+#include "libconvfont.h"
+#include "parse_fnt.h"
+#include "parse_fon.h"
+#include "parse_text.h"
+#include "serialize_font.h"
+
+
+/*******************************************************************************
+*                                  PLUMBING                                    *
+*******************************************************************************/
+
+void convfont_init_context(convfont_context_t *context) {
+    context->verbosity = 0;
+#ifdef _WIN32
+    context->unix_newline_style = false;
+#else
+    context->unix_newline_style = true;
+#endif
+    context->packing = packing_overlap;
+    context->error_code = 0;
+    context->error_message[0] = '\0';
+}
+
+/* Runs call(arguments) with the context's settings and with an error trap
+ * set, so that anything it throws ends up in the context instead of exiting.
+ * @return The context's new error_code. */
+static int call_trapped(convfont_context_t *context, void (*call)(void *arguments), void *arguments) {
+    int saved_verbosity = verbosity;
+    error_trap_t trap;
+    context->error_code = 0;
+    context->error_message[0] = '\0';
+    verbosity = context->verbosity;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        call(arguments);
+        pop_error_trap(&trap);
+    } else {
+        context->error_code = trap.code;
+        memcpy(context->error_message, trap.message, sizeof(context->error_message));
+    }
+    verbosity = saved_verbosity;
+    return context->error_code;
+}
+
+/* Output callback that fills a caller's buffer, counting whatever doesn't
+ * fit so the caller can be told how much room is needed. */
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+} memory_sink_t;
+
+static void output_memory_span(const uint8_t *data, size_t length, void *custom_data) {
+    memory_sink_t *sink = (memory_sink_t *)custom_data;
+    if (sink->length < sink->capacity)
+        memcpy(sink->buffer + sink->length, data, length <= sink->capacity - sink->length ? length : sink->capacity - sink->length);
+    sink->length += length;
+}
+
+
+/*******************************************************************************
+*                                   INPUT                                      *
+*******************************************************************************/
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    char encoding;
+    fontlib_font_t **fonts;
+    int max_fonts;
+    int *count;
+} parse_arguments_t;
+
+static void call_parse_fnt(void *arguments) {
+    parse_arguments_t *args = (parse_arguments_t *)arguments;
+    *args->fonts = parse_fnt_buffer(args->data, args->size, 0);
+}
+
+int convfont_parse_fnt(convfont_context_t *context, const uint8_t *data, size_t size, fontlib_font_t **font) {
+    parse_arguments_t args = { data, size, 0, font, 1, NULL };
+    *font = NULL;
+    return call_trapped(context, call_parse_fnt, &args);
+}
+
+static void call_parse_fon(void *arguments) {
+    parse_arguments_t *args = (parse_arguments_t *)arguments;
+    *args->count = parse_fon_buffer(args->data, args->size, args->fonts, args->max_fonts);
+}
+
+int convfont_parse_fon(convfont_context_t *context, const uint8_t *data, size_t size, fontlib_font_t **fonts, int max_fonts, int *count) {
+    parse_arguments_t args = { data, size, 0, fonts, max_fonts, count };
+    *count = 0;
+    return call_trapped(context, call_parse_fon, &args);
+}
+
+static void call_parse_text(void *arguments) {
+    parse_arguments_t *args = (parse_arguments_t *)arguments;
+    text_parser_t *parser = text_parser_create();
+    if (parser == NULL)
+        throw_error(malloc_failed, "convfont_parse_text: Failed to malloc parser state.");
+    int r = parse_text_buffer_r(parser, args->data, args->size, args->encoding, args->fonts);
+    if (r != 0) {
+        char message[256];
+        snprintf(message, sizeof(message), "%s", text_parser_message(parser));
+        text_parser_destroy(parser);
+        throw_error(r, message[0] != '\0' ? message : NULL);
+    }
+    text_parser_destroy(parser);
+}
+
+int convfont_parse_text(convfont_context_t *context, const uint8_t *data, size_t size, char encoding, fontlib_font_t **font) {
+    parse_arguments_t args = { data, size, encoding, font, 1, NULL };
+    *font = NULL;
+    return call_trapped(context, call_parse_text, &args);
+}
+
+void convfont_free_font(fontlib_font_t *font) {
+    if (font != NULL)
+        free_fnt(font);
+}
+
+
+/*******************************************************************************
+*                                   OUTPUT                                     *
+*******************************************************************************/
+
+typedef struct {
+    fontlib_font_t *font;
+    memory_sink_t sink;
+    bool unix_newline_style;
+    bitmap_packing_t packing;
+} serialize_arguments_t;
+
+static void call_serialize_font(void *arguments) {
+    serialize_arguments_t *args = (serialize_arguments_t *)arguments;
+    serialize_font_spans(args->font, args->packing, output_memory_span, &args->sink);
+    if (args->sink.length > args->sink.capacity)
+        throw_error(buffer_too_small, "Output buffer too small.");
+}
+
+int convfont_serialize_font(convfont_context_t *context, fontlib_font_t *font, uint8_t *buffer, size_t buffer_size, size_t *size) {
+    serialize_arguments_t args = { font, { buffer, buffer_size, 0 }, context->unix_newline_style, context->packing };
+    int r = call_trapped(context, call_serialize_font, &args);
+    *size = args.sink.length;
+    return r;
+}
+
+typedef struct {
+    fontlib_font_t **fonts;
+    int count;
+    const fontpack_metadata_t *metadata;
+    bitmap_packing_t packing;
+    memory_sink_t sink;
+} fontpack_arguments_t;
+
+static void call_serialize_fontpack(void *arguments) {
+    fontpack_arguments_t *args = (fontpack_arguments_t *)arguments;
+    fontpack_layout_t layout;
+    layout_fontpack(args->fonts, args->count, args->metadata, args->packing, &layout);
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        args->sink.length = layout.size;
+        if (layout.size > args->sink.capacity)
+            throw_error(buffer_too_small, "Output buffer too small.");
+        write_fontpack_image(args->fonts, args->metadata, &layout, args->sink.buffer);
+        pop_error_trap(&trap);
+    } else {
+        free_fontpack_layout(&layout);
+        rethrow_error(&trap);
+    }
+    free_fontpack_layout(&layout);
+}
+
+int convfont_serialize_fontpack(convfont_context_t *context, fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, uint8_t *buffer, size_t buffer_size, size_t *size) {
+    fontpack_arguments_t args = { fonts, count, metadata, context->packing, { buffer, buffer_size, 0 } };
+    int r = call_trapped(context, call_serialize_fontpack, &args);
+    *size = args.sink.length;
+    return r;
+}
+
+static void call_format_c_array(void *arguments) {
+    serialize_arguments_t *args = (serialize_arguments_t *)arguments;
+    static const uint8_t nul = '\0';
+    size_t image_size;
+    uint8_t *image = build_font_image(args->font, args->packing, &image_size, NULL);
+    format_c_array(image, image_size, args->unix_newline_style, output_memory_span, &args->sink);
+    free(image);
+    output_memory_span(&nul, 1, &args->sink);
+    if (args->sink.length > args->sink.capacity)
+        throw_error(buffer_too_small, "Output buffer too small.");
+}
+
+int convfont_format_c_array(convfont_context_t *context, fontlib_font_t *font, char *buffer, size_t buffer_size, size_t *size) {
+    serialize_arguments_t args = { font, { (uint8_t *)buffer, buffer_size, 0 }, context->unix_newline_style, context->packing };
+    int r = call_trapped(context, call_format_c_array, &args);
+    *size = args.sink.length;
+    return r;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "image.h"
+#include "pack_bitmaps.h"
+
+/* The library interface to convfont.  Everything here reads from and writes
+ * to memory, and errors are returned instead of exiting the process.
+ *
+ * Every function takes a context, which holds settings and the last error.
+ * A context may only be used by one thread at a time, but any number of
+ * threads can each use their own context at once. */
+
+typedef struct {
+    /* How much diagnostic chatter to print to stdout; 0 prints nothing. */
+    int verbosity;
+    /* Newline style for text output formats.  false means CR+LF. */
+    bool unix_newline_style;
+    /* How glyph bitmaps are laid out by the serialize functions. */
+    bitmap_packing_t packing;
+    /* Set by every call: 0 for success, otherwise an error_codes_t value. */
+    int error_code;
+    /* Describes the error if error_code is nonzero. */
+    char error_message[256];
+} convfont_context_t;
+
+/* Sets a context to its defaults: quiet, native newlines, overlap packing,
+ * no error.
+ * @param context The context to initialize. */
+void convfont_init_context(convfont_context_t *context);
+
+/* Parses a Windows FNT.
+ * @param context Settings and error information.
+ * @param data The contents of the FNT file.
+ * @param size Size of data in bytes.
+ * @param font Receives a font to pass to convfont_free_font() later.
+ * @return 0 on success, otherwise an error_codes_t value. */
+int convfont_parse_fnt(convfont_context_t *context, const uint8_t *data, size_t size, fontlib_font_t **font);
+
+/* Parses every font in a Windows .FON file.
+ * @param context Settings and error information.
+ * @param data The contents of the FON file.
+ * @param size Size of data in bytes.
+ * @param fonts Array to receive the fonts, each of which must be passed to
+ * convfont_free_font() later.
+ * @param max_fonts Number of slots in fonts.
+ * @param count Receives the number of fonts stored into fonts.
+ * @return 0 on success, otherwise an error_codes_t value. */
+int convfont_parse_fon(convfont_context_t *context, const uint8_t *data, size_t size, fontlib_font_t **fonts, int max_fonts, int *count);
+
+/* Parses a font in convfont's text format.
+ * @param context Settings and error information.
+ * @param data The contents of the text file.
+ * @param size Size of data in bytes.
+ * @param encoding The encoding to assume, or 0 to detect it.
+ * @param font Receives a font to pass to convfont_free_font() later.
+ * @return 0 on success, otherwise an error_codes_t value. */
+int convfont_parse_text(convfont_context_t *context, const uint8_t *data, size_t size, char encoding, fontlib_font_t **font);
+
+/* Serializes a font into FontLibC's binary format.
+ * @param context Settings and error information.
+ * @param font The font to serialize.
+ * @param buffer Where to write the font.  May be NULL if buffer_size is 0.
+ * @param buffer_size Size of buffer in bytes.
+ * @param size Receives the size of the serialized font.  If this is more than
+ * buffer_size, buffer_too_small is returned and nothing useful is written, so
+ * calling with a zero-size buffer first is a way to find the size needed.
+ * @return 0 on success, otherwise an error_codes_t value. */
+int convfont_serialize_font(convfont_context_t *context, fontlib_font_t *font, uint8_t *buffer, size_t buffer_size, size_t *size);
+
+/* Serializes several fonts into a font pack.
+ * @param context Settings and error information.
+ * @param fonts The fonts to pack.
+ * @param count Number of fonts.
+ * @param metadata Strings describing the pack; any may be NULL.
+ * @param buffer Where to write the pack.  May be NULL if buffer_size is 0.
+ * @param buffer_size Size of buffer in bytes.
+ * @param size Receives the size of the pack; see convfont_serialize_font().
+ * @return 0 on success, otherwise an error_codes_t value. */
+int convfont_serialize_fontpack(convfont_context_t *context, fontlib_font_t **fonts, int count, const fontpack_metadata_t *metadata, uint8_t *buffer, size_t buffer_size, size_t *size);
+
+/* Formats a serialized font as the body of a C array, exactly as -o carray
+ * does, using the context's newline style.  The output is NUL-terminated.
+ * @param context Settings and error information.
+ * @param font The font to format.
+ * @param buffer Where to write the text.  May be NULL if buffer_size is 0.
+ * @param buffer_size Size of buffer in bytes.
+ * @param size Receives the length of the text plus the terminating NUL; see
+ * convfont_serialize_font().
+ * @return 0 on success, otherwise an error_codes_t value. */
+int convfont_format_c_array(convfont_context_t *context, fontlib_font_t *font, char *buffer, size_t buffer_size, size_t *size);
+
+/* Frees a font returned by one of the parse functions.
+ * @param font The font to free; may be NULL. */
+void convfont_free_font(fontlib_font_t *font);
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "convfont.h"
+#include "output_file.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4996)
+#endif
+
+/* Works out which file is really being replaced.  A symlink is followed, so
+ * that the new file goes where the link points, as writing through it would,
+ * and the link itself is left alone.
+ * @return A malloc()ed name, or NULL if malloc() failed. */
+static char *real_output_name(const char *name) {
+#ifndef _WIN32
+    struct stat status;
+    if (lstat(name, &status) == 0 && S_ISLNK(status.st_mode)) {
+        char *target = realpath(name, NULL);
+        /* A dangling link just gets replaced. */
+        if (target != NULL)
+            return target;
+    }
+#endif
+    char *copy = malloc(strlen(name) + 1);
+    if (copy != NULL)
+        strcpy(copy, name);
+    return copy;
+}
+
+/* Gives the temporary file the same permissions as the file it replaces, if
+ * there is one, since renaming it into place would otherwise lose them. */
+static void copy_mode(output_file_t *output) {
+#ifndef _WIN32
+    struct stat status;
+    if (stat(output->name, &status) == 0)
+        fchmod(fileno(output->file), status.st_mode & 07777);
+#else
+    (void)output;
+#endif
+}
+
+bool open_output_file(const char *name, output_file_t *output) {
+    output->file = NULL;
+    output->temporary = NULL;
+    output->name = real_output_name(name);
+    if (output->name != NULL) {
+        /* Other threads or processes may be writing the same file, so the
+         * temporary name has to be unique to this one. */
+        size_t length = strlen(output->name) + 64;
+        output->temporary = malloc(length);
+        if (output->temporary != NULL) {
+            snprintf(output->temporary, length, "%s.%lx.%p.%lx.tmp", output->name, (unsigned long)getpid(), (void *)output, (unsigned long)time(NULL));
+            output->file = fopen(output->temporary, "wb");
+        }
+    }
+    if (output->file == NULL) {
+        free(output->name);
+        free(output->temporary);
+        output->name = output->temporary = NULL;
+        return false;
+    }
+    copy_mode(output);
+    return true;
+}
+
+/* Checks whether two files hold the same bytes. */
+static bool same_contents(const char *a_name, const char *b_name) {
+    char a_block[16384];
+    char b_block[16384];
+    size_t a_length;
+    size_t b_length;
+    bool same = false;
+    FILE *a = fopen(a_name, "rb");
+    FILE *b = fopen(b_name, "rb");
+    if (a != NULL && b != NULL)
+        for (;;) {
+            a_length = fread(a_block, 1, sizeof(a_block), a);
+            b_length = fread(b_block, 1, sizeof(b_block), b);
+            if (a_length != b_length || memcmp(a_block, b_block, a_length) != 0 || ferror(a) || ferror(b))
+                break;
+            if (a_length < sizeof(a_block)) {
+                same = true;
+                break;
+            }
+        }
+    if (a != NULL)
+        fclose(a);
+    if (b != NULL)
+        fclose(b);
+    return same;
+}
+
+static void release(output_file_t *output) {
+    free(output->name);
+    free(output->temporary);
+    output->name = output->temporary = NULL;
+    output->file = NULL;
+}
+
+output_result_t close_output_file(output_file_t *output) {
+    output_result_t result = output_failed;
+    bool written = !ferror(output->file);
+    if (fclose(output->file) == 0 && written) {
+        if (same_contents(output->temporary, output->name))
+            result = output_unchanged;
+#ifdef _WIN32
+        else if (MoveFileExA(output->temporary, output->name, MOVEFILE_REPLACE_EXISTING))
+#else
+        else if (rename(output->temporary, output->name) == 0)
+#endif
+            result = output_replaced;
+    }
+    if (result != output_replaced)
+        remove(output->temporary);
+    release(output);
+    return result;
+}
+
+void discard_output_file(output_file_t *output) {
+    fclose(output->file);
+    remove(output->temporary);
+    release(output);
+}
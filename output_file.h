@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* A file being written under a temporary name next to where it belongs, so
+ * that nothing ever sees it half-written.  When it's done, it replaces the
+ * real file in one step, unless the real file already holds the very same
+ * bytes, in which case the real file is left alone so that its modification
+ * time doesn't change and make doesn't rebuild everything that uses it. */
+typedef struct {
+    /* Where to write. */
+    FILE *file;
+    /* The file being replaced, after following any symlink. */
+    char *name;
+    /* Where the data is really going until then. */
+    char *temporary;
+} output_file_t;
+
+typedef enum {
+    output_failed,
+    output_unchanged,
+    output_replaced,
+} output_result_t;
+
+/* Starts writing a file.
+ * @param name The file to replace, which need not exist.
+ * @param output Receives the open temporary file.
+ * @return false if the temporary file couldn't be created. */
+bool open_output_file(const char *name, output_file_t *output);
+
+/* Finishes writing a file, putting it in place if it has changed.
+ * @param output The file, from open_output_file().
+ * @return output_failed if the file couldn't be finished, in which case the
+ * temporary file is removed and the real one is left as it was. */
+output_result_t close_output_file(output_file_t *output);
+
+/* Abandons writing a file, removing the temporary file and leaving the real
+ * one as it was.
+ * @param output The file, from open_output_file(). */
+void discard_output_file(output_file_t *output);
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "pack_bitmaps.h"
+
+/* Slots in the hash table used to spot duplicate bitmaps.  This must be a
+ * power of two, and it is kept comfortably above the 256 glyphs a font can
+ * have so probe chains stay short. */
+#define BITMAP_HASH_SLOTS 1024
+
+/* Room for the largest possible bitmap, 255 rows of 3 bytes, rounded up so
+ * arrays of them stay aligned. */
+#define MAX_BITMAP_SIZE 768
+
+uint32_t hash_bitmap(int columns, const fontlib_bitmap_t *bitmap) {
+    uint32_t hash = (2166136261u ^ (uint32_t)columns) * 16777619u;
+    for (int i = 0; i < bitmap->length; i++)
+        hash = (hash ^ bitmap->bytes[i]) * 16777619u;
+    return hash;
+}
+
+bool same_bitmap(fontlib_font_t *a, int glyph_a, fontlib_font_t *b, int glyph_b) {
+    return byte_columns(a->widths_table[glyph_a]) == byte_columns(b->widths_table[glyph_b])
+        && a->bitmaps[glyph_a]->length == b->bitmaps[glyph_b]->length
+        && !memcmp(a->bitmaps[glyph_a]->bytes, b->bitmaps[glyph_b]->bytes, a->bitmaps[glyph_a]->length);
+}
+
+int find_shared_bitmaps(fontlib_font_t *font, int first[256]) {
+    int16_t slots[BITMAP_HASH_SLOTS];
+    int size = 0;
+    if (font->total_glyphs > 256)
+        throw_error(internal_error, "serialize_font: More than 256 glyphs.");
+    memset(slots, -1, sizeof(slots));
+    for (int i = 0; i < font->total_glyphs; i++) {
+        int columns = byte_columns(font->widths_table[i]);
+        fontlib_bitmap_t *bitmap = font->bitmaps[i];
+        uint32_t slot = hash_bitmap(columns, bitmap) & (BITMAP_HASH_SLOTS - 1);
+        first[i] = i;
+        for (; slots[slot] >= 0; slot = (slot + 1) & (BITMAP_HASH_SLOTS - 1)) {
+            int j = slots[slot];
+            if (same_bitmap(font, j, font, i)) {
+                first[i] = j;
+                break;
+            }
+        }
+        if (first[i] == i) {
+            slots[slot] = (int16_t)i;
+            size += bitmap->length;
+        }
+    }
+    return size;
+}
+
+int reverse_glyph_rows(fontlib_font_t *font, int glyph, uint8_t *dest) {
+    int columns = byte_columns(font->widths_table[glyph]);
+    const uint8_t *source = font->bitmaps[glyph]->bytes;
+    for (int y = 0; y < font->height; y++, source += columns)
+        for (int c = columns - 1; c >= 0; c--)
+            *dest++ = source[c];
+    return font->height * columns;
+}
+
+/* Appends a glyph's bitmap to the layout, leaving off the first skip bytes. */
+static void add_piece(packed_bitmaps_t *packed, int glyph, int length, int skip) {
+    packed->offsets[glyph] = packed->size - skip;
+    packed->piece_glyphs[packed->piece_count] = glyph;
+    packed->piece_skips[packed->piece_count++] = skip;
+    packed->size += length - skip;
+}
+
+
+/*******************************************************************************
+*                               OVERLAP PACKING                                *
+*******************************************************************************/
+
+/* Builds the Knuth-Morris-Pratt failure table for a pattern: fail[i] is the
+ * length of the longest proper prefix of pattern[0..i] that is also a suffix
+ * of it. */
+static void kmp_table(const uint8_t *pattern, int length, int16_t *fail) {
+    fail[0] = 0;
+    for (int i = 1, k = 0; i < length; i++) {
+        while (k > 0 && pattern[i] != pattern[k])
+            k = fail[k - 1];
+        if (pattern[i] == pattern[k])
+            k++;
+        fail[i] = (int16_t)k;
+    }
+}
+
+/* Searches text for pattern.
+ * @param overlap If pattern is not found, receives the length of the longest
+ * suffix of text that is also a prefix of pattern.
+ * @return Where pattern starts in text, or -1 if it doesn't appear. */
+static int kmp_scan(const uint8_t *text, int text_length, const uint8_t *pattern, int pattern_length, const int16_t *fail, int *overlap) {
+    int k = 0;
+    for (int i = 0; i < text_length; i++) {
+        while (k > 0 && text[i] != pattern[k])
+            k = fail[k - 1];
+        if (text[i] == pattern[k])
+            k++;
+        if (k == pattern_length)
+            return i - k + 1;
+    }
+    *overlap = k;
+    return -1;
+}
+
+/* A candidate for putting one bitmap straight after another. */
+typedef struct {
+    int16_t overlap;
+    uint8_t from;
+    uint8_t to;
+} overlap_t;
+
+/* Biggest overlaps first; ties go in index order so output is repeatable. */
+static int compare_overlaps(const void *a, const void *b) {
+    const overlap_t *x = (const overlap_t *)a;
+    const overlap_t *y = (const overlap_t *)b;
+    if (x->overlap != y->overlap)
+        return y->overlap - x->overlap;
+    if (x->from != y->from)
+        return x->from - y->from;
+    return x->to - y->to;
+}
+
+/* Union-find lookup, used to avoid linking a chain of bitmaps into a loop. */
+static int find_chain(int *chain, int i) {
+    while (chain[i] != i)
+        i = chain[i] = chain[chain[i]];
+    return i;
+}
+
+/* Does the work of pack_bitmaps() for packing_overlap.
+ * @param first Output of find_shared_bitmaps(); only the first of each set of
+ * identical bitmaps is placed here. */
+static void overlap_bitmaps(fontlib_font_t *font, const int first[256], const bool *borrowed, packed_bitmaps_t *packed) {
+    int unique[256];
+    int lengths[256];
+    int count = 0;
+    /* Longest first, so anything that fits inside another bitmap is only
+     * looked for after everything it could fit inside. */
+    for (int i = 0; i < font->total_glyphs; i++) {
+        if (first[i] != i || (borrowed != NULL && borrowed[i]))
+            continue;
+        int u = count++;
+        for (; u > 0 && font->bitmaps[unique[u - 1]]->length < font->bitmaps[i]->length; u--)
+            unique[u] = unique[u - 1];
+        unique[u] = i;
+    }
+    size_t strings_size = (size_t)count * MAX_BITMAP_SIZE;
+    size_t fails_size = (size_t)count * MAX_BITMAP_SIZE * sizeof(int16_t);
+    size_t pairs_size = (size_t)count * count * sizeof(overlap_t);
+    uint8_t *scratch = malloc(strings_size + fails_size + pairs_size + 1);
+    if (scratch == NULL)
+        throw_error(malloc_failed, "pack_bitmaps: failed to malloc scratch space");
+    uint8_t *strings = scratch;
+    int16_t *fails = (int16_t *)(scratch + strings_size);
+    overlap_t *pairs = (overlap_t *)(scratch + strings_size + fails_size);
+#define STRING(u) (strings + (size_t)(u) * MAX_BITMAP_SIZE)
+#define FAIL(u) (fails + (size_t)(u) * MAX_BITMAP_SIZE)
+    for (int u = 0; u < count; u++) {
+        lengths[u] = reverse_glyph_rows(font, unique[u], STRING(u));
+        kmp_table(STRING(u), lengths[u], FAIL(u));
+    }
+
+    /* Bitmaps found inside another need no space of their own. */
+    int kept[256];
+    int kept_count = 0;
+    int container[256];
+    int position[256];
+    int overlap;
+    for (int u = 0; u < count; u++) {
+        container[u] = -1;
+        for (int k = 0; k < kept_count && container[u] < 0; k++) {
+            position[u] = kmp_scan(STRING(kept[k]), lengths[kept[k]], STRING(u), lengths[u], FAIL(u), &overlap);
+            if (position[u] >= 0)
+                container[u] = kept[k];
+        }
+        if (container[u] < 0)
+            kept[kept_count++] = u;
+    }
+
+    /* Greedily join the pairs with the biggest overlaps into chains. */
+    int pair_count = 0;
+    for (int a = 0; a < kept_count; a++)
+        for (int b = 0; b < kept_count; b++)
+            if (a != b && kmp_scan(STRING(kept[a]), lengths[kept[a]], STRING(kept[b]), lengths[kept[b]], FAIL(kept[b]), &overlap) < 0 && overlap > 0) {
+                pairs[pair_count].overlap = (int16_t)overlap;
+                pairs[pair_count].from = (uint8_t)a;
+                pairs[pair_count++].to = (uint8_t)b;
+            }
+    qsort(pairs, pair_count, sizeof(overlap_t), compare_overlaps);
+    int next[256];
+    int skip[256];
+    int chain[256];
+    bool has_previous[256];
+    for (int a = 0; a < kept_count; a++) {
+        next[a] = -1;
+        skip[a] = 0;
+        chain[a] = a;
+        has_previous[a] = false;
+    }
+    for (int p = 0; p < pair_count; p++) {
+        int a = pairs[p].from;
+        int b = pairs[p].to;
+        if (next[a] >= 0 || has_previous[b] || find_chain(chain, a) == find_chain(chain, b))
+            continue;
+        next[a] = b;
+        skip[b] = pairs[p].overlap;
+        has_previous[b] = true;
+        chain[find_chain(chain, a)] = find_chain(chain, b);
+    }
+
+    /* Lay the chains out one after another. */
+    for (int a = 0; a < kept_count; a++)
+        if (!has_previous[a])
+            for (int i = a; i >= 0; i = next[i])
+                add_piece(packed, unique[kept[i]], lengths[kept[i]], skip[i]);
+    for (int u = 0; u < count; u++)
+        if (container[u] >= 0)
+            packed->offsets[unique[u]] = packed->offsets[unique[container[u]]] + position[u];
+#undef STRING
+#undef FAIL
+    free(scratch);
+}
+
+
+/*******************************************************************************
+*                                   LAYOUT                                     *
+*******************************************************************************/
+
+void pack_bitmaps(fontlib_font_t *font, bitmap_packing_t packing, const bool *borrowed, packed_bitmaps_t *packed) {
+    int first[256];
+    int full_size = 0;
+    find_shared_bitmaps(font, first);
+    packed->piece_count = 0;
+    packed->size = 0;
+    for (int i = 0; i < font->total_glyphs; i++)
+        packed->offsets[i] = -1;
+    if (packing == packing_overlap)
+        overlap_bitmaps(font, first, borrowed, packed);
+    else
+        for (int i = 0; i < font->total_glyphs; i++)
+            if ((packing == packing_none || first[i] == i) && (borrowed == NULL || !borrowed[i]))
+                add_piece(packed, i, font->bitmaps[i]->length, 0);
+    for (int i = 0; i < font->total_glyphs; i++) {
+        full_size += font->bitmaps[i]->length;
+        /* Duplicates point at their first twin. */
+        if (packing != packing_none && first[i] != i)
+            packed->offsets[i] = packed->offsets[first[i]];
+    }
+    packed->saved = full_size - packed->size;
+}
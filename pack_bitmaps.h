@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* How glyph bitmaps are laid out in a serialized font. */
+typedef enum {
+    /* Every glyph gets its own copy of its bitmap. */
+    packing_none,
+    /* Glyphs with identical bitmaps share one copy. */
+    packing_dedup,
+    /* Bitmaps are also overlapped wherever one ends with the bytes another
+     * starts with, or contained inside another. */
+    packing_overlap,
+} bitmap_packing_t;
+
+/* Where each glyph's bitmap ends up in a font's bitmap data. */
+typedef struct {
+    /* Offset of each glyph's bitmap from the start of the bitmap data.  A
+     * bitmap borrowed from a later font is past the end of the data. */
+    int offsets[256];
+    /* The glyphs whose bitmaps are actually written, in order.  The first
+     * piece_skips[i] bytes of each are left out because the bitmap before
+     * it already ends with them. */
+    int piece_count;
+    int piece_glyphs[256];
+    int piece_skips[256];
+    /* Total size of the bitmap data in bytes. */
+    int size;
+    /* How much smaller size is than with packing_none. */
+    int saved;
+} packed_bitmaps_t;
+
+/* FNV-1a over a glyph's column count and bitmap, which is everything that
+ * decides whether two glyphs can share a bitmap. */
+uint32_t hash_bitmap(int columns, const fontlib_bitmap_t *bitmap);
+
+/* Checks whether two glyphs, possibly from different fonts, can share a
+ * bitmap. */
+bool same_bitmap(fontlib_font_t *a, int glyph_a, fontlib_font_t *b, int glyph_b);
+
+/* Finds glyphs that can share a bitmap.  The offsets table encodes the number
+ * of byte columns rather than the width, so two glyphs can point at the same
+ * bytes whenever their column counts and bitmaps match, even if their widths
+ * differ.
+ * @param font The font to examine
+ * @param first Receives, for each glyph, the index of the first glyph with an
+ * identical bitmap, which is the glyph itself if it has no earlier twin
+ * @return The total size of the bitmaps that must actually be stored */
+int find_shared_bitmaps(fontlib_font_t *font, int first[256]);
+
+/* Puts a glyph's bitmap in the order FontLibC wants: row by row, with the
+ * bytes of each row reversed.
+ * @param font The font containing the glyph
+ * @param glyph Index of the glyph
+ * @param dest Where to write the bitmap; must have room for its length
+ * @return The length of the bitmap */
+int reverse_glyph_rows(fontlib_font_t *font, int glyph, uint8_t *dest);
+
+/* Lays out a font's glyph bitmaps.  Overlap packing is a greedy shortest
+ * common superstring, which is not always optimal but is quick.
+ * @param font The font to lay out
+ * @param packing How hard to try to save space
+ * @param borrowed May be NULL.  Otherwise, glyphs flagged here are stored
+ * somewhere else, such as in another font of a font pack.  They take up no
+ * space, and their offsets are left as -1 for the caller to fill in.  Glyphs
+ * with identical bitmaps must be flagged alike.
+ * @param packed Receives the layout */
+void pack_bitmaps(fontlib_font_t *font, bitmap_packing_t packing, const bool *borrowed, packed_bitmaps_t *packed);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <ctype.h>
+#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -12,7 +14,33 @@ int16_t read_word(FILE *input);
 
 int32_t read_dword(FILE *input);
 
-/* Frees a malloc()ed font for you.
+/* A bounds-checked window onto an FNT loaded into memory.  Every accessor
+ * throws invalid_fnt instead of reading past size. */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} fnt_view_t;
+
+uint8_t view_byte(fnt_view_t *view);
+
+int16_t view_word(fnt_view_t *view);
+
+int32_t view_dword(fnt_view_t *view);
+
+/* Returns a pointer to the next length bytes and advances past them. */
+const uint8_t *view_block(fnt_view_t *view, size_t length);
+
+/* Allocates a font and all of its glyph storage as a single block, so the
+ * bitmaps sit next to each other in memory and one free() releases the lot.
+ * The bitmaps table and each bitmap's length are filled in; everything else
+ * is zeroed.
+ * @param total_glyphs Number of glyphs, which sets total_glyphs.
+ * @param lengths Size in bytes of each glyph's bitmap.
+ * @return A pointer to the new font, to be released with free_fnt(). */
+fontlib_font_t *alloc_font(int total_glyphs, const int *lengths);
+
+/* Frees a font from alloc_font() for you.
  * @param font Pointer to the font to free. */
 void free_fnt(fontlib_font_t *font);
 
@@ -22,3 +50,10 @@ void free_fnt(fontlib_font_t *font);
  * @return A pointer to a malloc()ed font. */
 fontlib_font_t *parse_fnt(FILE *input, int offset);
 
+/* Unpacks an FNT already in memory into RAM.
+ * @param data The start of the file containing the FNT.
+ * @param size The total size of data, used for bounds checking.
+ * @param offset The location of the FNT in data.
+ * @return A pointer to a malloc()ed font. */
+fontlib_font_t *parse_fnt_buffer(const uint8_t *data, size_t size, int offset);
+
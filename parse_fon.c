@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "convfont.h"
+#include "file_buffer.h"
+#include "parse_fnt.h"
+#include "parse_fon.h"
+
+/* See http://benoit.papillault.free.fr/c/disc2/exefmt.txt for the NE format. */
+
+#define MZ_NEW_HEADER_OFFSET 0x3C
+#define NE_RESOURCE_TABLE_OFFSET 0x24
+#define RT_FONT 0x8008
+#define NAMEINFO_SIZE 12
+
+/* Unpacks every FNT embedded in a .FON (NE executable) file into RAM.
+ * @param input The already-opened file to read from.
+ * @param fonts Array to store pointers to malloc()ed fonts into.
+ * @param max_fonts Number of slots available in fonts.
+ * @return The number of fonts stored into fonts. */
+int parse_fon(FILE *input, fontlib_font_t **fonts, int max_fonts) {
+    file_buffer_t buffer;
+    if (!map_file(input, &buffer))
+        throw_error(bad_infile, "parse_fon: failed to load input file");
+    int count;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        count = parse_fon_buffer(buffer.data, buffer.size, fonts, max_fonts);
+        pop_error_trap(&trap);
+    } else {
+        unmap_file(&buffer);
+        rethrow_error(&trap);
+    }
+    unmap_file(&buffer);
+    return count;
+}
+
+static int read_fon(const uint8_t *data, size_t size, fontlib_font_t **fonts, int max_fonts);
+
+/* Unpacks every FNT embedded in a .FON already in memory into RAM.
+ * @param data The contents of the .FON file.
+ * @param size The total size of data, used for bounds checking.
+ * @param fonts Array to store pointers to malloc()ed fonts into.
+ * @param max_fonts Number of slots available in fonts.
+ * @return The number of fonts stored into fonts. */
+int parse_fon_buffer(const uint8_t *data, size_t size, fontlib_font_t **fonts, int max_fonts) {
+    int count;
+    /* Clear the slots first so we know which fonts to free after an error. */
+    for (int i = 0; i < max_fonts; i++)
+        fonts[i] = NULL;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        count = read_fon(data, size, fonts, max_fonts);
+        pop_error_trap(&trap);
+    } else {
+        for (int i = 0; i < max_fonts && fonts[i] != NULL; i++) {
+            free_fnt(fonts[i]);
+            fonts[i] = NULL;
+        }
+        rethrow_error(&trap);
+    }
+    return count;
+}
+
+/* Does the actual work of parse_fon_buffer(). */
+static int read_fon(const uint8_t *data, size_t size, fontlib_font_t **fonts, int max_fonts) {
+    fnt_view_t view = { data, size, 0 };
+    /* DOS stub header */
+    if (view_byte(&view) != 'M' || view_byte(&view) != 'Z')
+        throw_error(invalid_fnt, "FON does not start with an MZ header.");
+    view.pos = MZ_NEW_HEADER_OFFSET;
+    size_t ne_offset = (uint32_t)view_dword(&view);
+    /* The actual NE header */
+    view.pos = ne_offset;
+    if (view_byte(&view) != 'N' || view_byte(&view) != 'E')
+        throw_error(invalid_fnt, "FON is not an NE executable.");
+    view.pos = ne_offset + NE_RESOURCE_TABLE_OFFSET;
+    view.pos = ne_offset + (uint16_t)view_word(&view);
+    /* Resource table */
+    int align_shift = (uint16_t)view_word(&view);
+    if (verbosity >= 2) printf("Resource alignment shift: %i\n", align_shift);
+    if (align_shift > 16)
+        throw_error(invalid_fnt, "Resource alignment shift is nonsense.");
+    int count = 0;
+    for (uint16_t type_id = view_word(&view); type_id != 0; type_id = view_word(&view)) {
+        int resource_count = (uint16_t)view_word(&view);
+        view_dword(&view);
+        if (verbosity >= 3) printf("Resource type 0x%04X: %i resource(s)\n", type_id, resource_count);
+        if (type_id != RT_FONT) {
+            view_block(&view, (size_t)resource_count * NAMEINFO_SIZE);
+            continue;
+        }
+        for (int i = 0; i < resource_count; i++) {
+            size_t location = (size_t)(uint16_t)view_word(&view) << align_shift;
+            size_t length = (size_t)(uint16_t)view_word(&view) << align_shift;
+            view_word(&view); /* Flags */
+            int id = (uint16_t)view_word(&view);
+            view_dword(&view); /* Reserved */
+            if (verbosity >= 1) printf("FON resource 0x%04X: FNT @ 0x%08X, %i bytes\n", id, (unsigned)location, (int)length);
+            if (location > size || size - location < length)
+                throw_error(invalid_fnt, "FON font resource extends past end of file.");
+            if (count >= max_fonts)
+                throw_error(bad_options, "-F: Too many fonts in FON.");
+            /* The FNT only gets its own resource, so nothing it claims can
+             * reach into whatever follows. */
+            fonts[count++] = parse_fnt_buffer(data + location, length, 0);
+        }
+    }
+    if (count == 0)
+        throw_error(invalid_fnt, "FON does not contain any fonts.");
+    return count;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* Unpacks every FNT embedded in a .FON (NE executable) file into RAM.
+ * @param input The already-opened file to read from.
+ * @param fonts Array to store pointers to malloc()ed fonts into.
+ * @param max_fonts Number of slots available in fonts.
+ * @return The number of fonts stored into fonts. */
+int parse_fon(FILE *input, fontlib_font_t **fonts, int max_fonts);
+
+/* Unpacks every FNT embedded in a .FON already in memory into RAM.
+ * @param data The contents of the .FON file.
+ * @param size The total size of data, used for bounds checking.
+ * @param fonts Array to store pointers to malloc()ed fonts into.
+ * @param max_fonts Number of slots available in fonts.
+ * @return The number of fonts stored into fonts. */
+int parse_fon_buffer(const uint8_t *data, size_t size, fontlib_font_t **fonts, int max_fonts);
@@ -6,9 +6,30 @@
 #include <limits.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXT_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "convfont.h"
+#include "parse_fnt.h"
 #include "parse_text.h"
 
+#ifdef TEXT_SSE2
+static unsigned count_trailing_zeros(unsigned x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(x);
+#endif
+}
+#endif
+
 enum {
     IGNORED_FONT_TAG,
     FORCE_EIGHT_BIT,
@@ -83,6 +104,7 @@ string_value_pair_t font_tag_names[] =
     { "width", DEFAULT_WIDTH },
     { "fixedwidth", FIXED_WIDTH },
     { "fixed width", FIXED_WIDTH },
+    { "fixed-width", FIXED_WIDTH },
     { "fixed_width", FIXED_WIDTH },
     { "invert", INVERTED_MODE },
     { "inverted", INVERTED_MODE },
@@ -98,8 +120,8 @@ string_value_pair_t font_tag_names[] =
     { "[data]", GLYPH_DATA },
 };
 
-const string_list_t font_tags = {
-    sizeof(font_tag_names) / sizeof(string_value_pair_t), font_tag_names
+string_list_t font_tags = {
+    .count = sizeof(font_tag_names) / sizeof(string_value_pair_t), .strings = font_tag_names
 };
 
 enum {
@@ -138,8 +160,8 @@ string_value_pair_t glyph_tag_names[] =
     { "[bitmap]", DATA },
 };
 
-const string_list_t glyph_tags = {
-    sizeof(glyph_tag_names) / sizeof(string_value_pair_t), glyph_tag_names
+string_list_t glyph_tags = {
+    .count = sizeof(glyph_tag_names) / sizeof(string_value_pair_t), .strings = glyph_tag_names
 };
 
 string_value_pair_t bool_names[] =
@@ -164,8 +186,8 @@ string_value_pair_t bool_names[] =
     { "sure", 1 },
 };
 
-const string_list_t bools = {
-    sizeof(bool_names) / sizeof(string_value_pair_t), bool_names
+string_list_t bools = {
+    .count = sizeof(bool_names) / sizeof(string_value_pair_t), .strings = bool_names
 };
 
 
@@ -207,9 +229,132 @@ enum {
 enum {
     START, /**< Expecting the start of a potential surrogate pair. */
     NEXT, /**< Expecting the continuation of a surrogate pair. */
-    UNGOT /**< A previously read codepoint has been returned to the queue, so don't try to reparse it. */
 };
 
+/**
+ * How get_next() treats a codepoint.
+ */
+enum {
+    CHAR_NORMAL, /**< Passed through as-is. */
+    CHAR_SPACE, /**< Converted into a plain space. */
+    CHAR_IGNORED, /**< Skipped entirely. */
+    CHAR_SINGLE_QUOTE, /**< Converted into '. */
+    CHAR_DOUBLE_QUOTE, /**< Converted into ". */
+};
+
+/* Character classes, split into 256-codepoint pages.  Pages not listed in
+ * char_class_pages are entirely CHAR_NORMAL. */
+static const uint8_t char_class_00[256] = {
+    [0xA0] = CHAR_SPACE, /* Non-breaking space */
+    [0xAD] = CHAR_IGNORED, /* Soft hyphen */
+    [0xAB] = CHAR_DOUBLE_QUOTE, /* << */
+    [0xBB] = CHAR_DOUBLE_QUOTE, /* >> */
+};
+
+#define IGNORED_X16 CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, \
+    CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, \
+    CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, \
+    CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED, CHAR_IGNORED
+static const uint8_t char_class_03[256] = {
+    /* Combining diacritical marks, U+0300 through U+036F */
+    IGNORED_X16, IGNORED_X16, IGNORED_X16, IGNORED_X16, IGNORED_X16, IGNORED_X16, IGNORED_X16,
+};
+#undef IGNORED_X16
+
+static const uint8_t char_class_16[256] = {
+    [0x80] = CHAR_SPACE, /* Ogham space mark */
+};
+
+static const uint8_t char_class_20[256] = {
+    [0x00] = CHAR_SPACE, /* En quad */
+    [0x01] = CHAR_SPACE, /* Em quad */
+    [0x02] = CHAR_SPACE, /* En space */
+    [0x03] = CHAR_SPACE, /* Em space */
+    [0x04] = CHAR_SPACE,
+    [0x05] = CHAR_SPACE,
+    [0x06] = CHAR_SPACE,
+    [0x07] = CHAR_SPACE,
+    [0x08] = CHAR_SPACE, /* Punctuation space */
+    [0x09] = CHAR_IGNORED, /* Thin space */
+    [0x0A] = CHAR_IGNORED, /* Hair space */
+    [0x0B] = CHAR_IGNORED, /* Zero width space */
+    [0x0C] = CHAR_IGNORED, /* Zero width non-joiner */
+    [0x0D] = CHAR_IGNORED, /* Zero width joiner */
+    [0x12] = CHAR_SPACE, /* Figure dash (same width as digits 0-9) */
+    [0x13] = CHAR_SPACE, /* En dash */
+    [0x14] = CHAR_SPACE, /* Em dash */
+    [0x18] = CHAR_SINGLE_QUOTE, /* Left single quotation mark */
+    [0x19] = CHAR_SINGLE_QUOTE, /* Right single quotation mark */
+    [0x1A] = CHAR_SINGLE_QUOTE, /* Single low-9 quotation mark */
+    [0x1B] = CHAR_SINGLE_QUOTE, /* Single high-reversed-9 quotation mark */
+    [0x1C] = CHAR_DOUBLE_QUOTE, /* Left double quotation mark */
+    [0x1D] = CHAR_DOUBLE_QUOTE, /* Right double quotation mark */
+    [0x1E] = CHAR_DOUBLE_QUOTE, /* Double low-9 quotation mark */
+    [0x1F] = CHAR_DOUBLE_QUOTE, /* Double high-reversed-9 quotation mark */
+    [0x2F] = CHAR_SPACE, /* Narrow no-break space */
+    [0x39] = CHAR_SINGLE_QUOTE, /* < */
+    [0x3A] = CHAR_SINGLE_QUOTE, /* > */
+    [0x5F] = CHAR_SPACE, /* Medium mathematical space */
+    [0x60] = CHAR_IGNORED, /* Word joiner */
+};
+
+static const uint8_t char_class_22[256] = {
+    [0x12] = CHAR_SPACE, /* Minus sign (same width as +) */
+};
+
+static const uint8_t char_class_23[256] = {
+    [0x1C] = CHAR_SINGLE_QUOTE, /* Top left corner */
+    [0x1D] = CHAR_SINGLE_QUOTE, /* Top right corner */
+};
+
+static const uint8_t char_class_2E[256] = {
+    [0x42] = CHAR_DOUBLE_QUOTE, /* Double low-reversed-9 quotation mark */
+};
+
+static const uint8_t char_class_30[256] = {
+    [0x00] = CHAR_SPACE, /* Ideographic space */
+    [0x0C] = CHAR_SINGLE_QUOTE, /* Left corner bracket */
+    [0x0D] = CHAR_SINGLE_QUOTE, /* Right corner bracket */
+    [0x0E] = CHAR_DOUBLE_QUOTE, /* Left white corner bracket */
+    [0x0F] = CHAR_DOUBLE_QUOTE, /* Right white corner bracket */
+    [0x1D] = CHAR_DOUBLE_QUOTE, /* Reversed double prime quotation mark */
+    [0x1E] = CHAR_DOUBLE_QUOTE, /* Double prime quotation mark */
+    [0x1F] = CHAR_DOUBLE_QUOTE, /* Low double prime quotation mark */
+};
+
+static const uint8_t char_class_FE[256] = {
+    [0x41] = CHAR_SINGLE_QUOTE, /* Presentation form for vertical left corner bracket */
+    [0x42] = CHAR_SINGLE_QUOTE, /* Presentation form for vertical right corner bracket */
+    [0x43] = CHAR_DOUBLE_QUOTE, /* Presentation form for vertical left white corner bracket */
+    [0x44] = CHAR_DOUBLE_QUOTE, /* Presentation form for vertical right white corner bracket */
+    [0xFF] = CHAR_IGNORED, /* Zero width non-breaking space or Byte order mark */
+};
+
+static const uint8_t char_class_FF[256] = {
+    [0x02] = CHAR_DOUBLE_QUOTE, /* Fullwidth quotation mark */
+    [0x07] = CHAR_SINGLE_QUOTE, /* Fullwidth apostrophe */
+    [0x62] = CHAR_SINGLE_QUOTE, /* Halfwidth left corner bracket */
+    [0x63] = CHAR_SINGLE_QUOTE, /* Halfwidth right corner bracket */
+};
+
+static const uint8_t *const char_class_pages[256] = {
+    [0x00] = char_class_00,
+    [0x03] = char_class_03,
+    [0x16] = char_class_16,
+    [0x20] = char_class_20,
+    [0x22] = char_class_22,
+    [0x23] = char_class_23,
+    [0x2E] = char_class_2E,
+    [0x30] = char_class_30,
+    [0xFE] = char_class_FE,
+    [0xFF] = char_class_FF,
+};
+
+/**
+ * Size of the block read from the input file at a time.
+ */
+#define READ_BUFFER_SIZE 16384
+
 /**
 * Current state of file parser.
 */
@@ -224,6 +369,16 @@ typedef struct parser_state {
      * For UTF-16 coding, this holds the state of the surrogate pair parser.
      */
     char expecting;
+    /**
+     * A codepoint returned to the queue by unget(), or -1 if none.
+     */
+    int ungot;
+    /**
+     * Next unread byte and end of the valid data in buffer.
+     */
+    const uint8_t *next;
+    const uint8_t *end;
+    uint8_t buffer[READ_BUFFER_SIZE];
     int line_number;
     int line_pos;
     int line_len;
@@ -236,24 +391,80 @@ typedef struct parser_state {
 
 #define ERROR(X) throw_errorf(text_parser_error, "Line %i: " X, state->line_number)
 
-#define NEXT_RAW(X) do { if ((X = fgetc(state->file)) < 0) return X; } while (false)
-#define NEXT_RAW_THROW(X, Y) do { if ((X = fgetc(state->file)) < 0) ERROR(Y); } while (false)
+#define NEXT_RAW(X) do { if ((X = next_byte(state)) < 0) return X; } while (false)
+#define NEXT_RAW_THROW(X, Y) do { if ((X = next_byte(state)) < 0) ERROR(Y); } while (false)
 #define NEXT(X) do { if ((X = get_next_char(state)) < 0) return X; } while (false)
 #define NEXT_THROW(X, Y) do { if ((X = get_next_char(state)) < 0) ERROR(Y); } while (false)
 
 
+/**
+ * Reads the next block of the input file into the buffer.
+ * @return false if there is nothing left to read, which is always the case
+ * when parsing from memory.
+ */
+static bool refill(parser_state_t *state) {
+    if (state->file == NULL)
+        return false;
+    size_t n = fread(state->buffer, 1, READ_BUFFER_SIZE, state->file);
+    state->next = state->buffer;
+    state->end = state->buffer + n;
+    return n > 0;
+}
+
+
+/**
+ * Gets the next raw byte.
+ * @return int EOF at end of input.
+ */
+static int next_byte(parser_state_t *state) {
+    if (state->next == state->end && !refill(state))
+        return EOF;
+    return *state->next++;
+}
+
+
+/**
+ * Counts how many bytes at the start of a block are plain ASCII that needs no
+ * decoding or normalization, i.e. anything except NUL, CR, LF, and bytes with
+ * the high bit set.
+ */
+static size_t ascii_run_length(const uint8_t *p, size_t max) {
+    size_t i = 0;
+#ifdef TEXT_SSE2
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= max; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)), _mm_cmpeq_epi8(v, zero));
+        /* movemask on the raw bytes picks up the high bits directly. */
+        unsigned mask = (unsigned)(_mm_movemask_epi8(special) | _mm_movemask_epi8(v));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+    for (; i < max; i++) {
+        uint8_t c = p[i];
+        if (c == 0 || c == '\r' || c == '\n' || c >= 0x80)
+            break;
+    }
+    return i;
+}
+
+
 /**
  * Gets the next codepoint.
  * @return int Negative on failure.
  */
 static int get_next_char(parser_state_t *state) {
     long int c, c2;
+    if (state->ungot >= 0) {
+        c = state->ungot;
+        state->ungot = -1;
+        return c;
+    }
     NEXT_RAW(c);
     if (state->encoding == UTF16BE || state->encoding == UTF16LE) {
-        if (state->expecting == UNGOT) {
-            state->expecting = START;
-            return c;
-        }
         NEXT_RAW_THROW(c2, "UTF-16 decoder: Failed to get second byte of UTF-16 pair.");
         if (state->encoding == UTF16BE)
             c = (c << 8) | c2;
@@ -317,8 +528,7 @@ static int get_next_char(parser_state_t *state) {
  * Returns a codepoint to the read buffer.
  */
 static void unget(int c, parser_state_t *state) {
-    state->expecting = UNGOT;
-    ungetc(c, state->file);
+    state->ungot = c;
 }
 
 
@@ -332,76 +542,22 @@ static int get_next(parser_state_t *state) {
     int c;
 read_again:
     NEXT(c);
-    if (state->encoding > ASCII) {
-        switch (c) {
-            /* Convert things like spaces into actual spaces */
-            case 0xA0: /* Non-breaking space */
-            case 0x1680: /* Ogham space mark */
-            case 0x2000: /* En quad */
-            case 0x2002: /* En space */
-            case 0x2001: /* Em quad */
-            case 0x2003: /* Em space */
-            case 0x2004:
-            case 0x2005:
-            case 0x2006:
-            case 0x2007:
-            case 0x2008: /* Punctuation space */
-            case 0x202F: /* Narrow no-break space */
-            case 0x205F: /* Medium mathematical space */
-            case 0x2012: /* Figure dash (same width as digits 0-9) */
-            case 0x2013: /* En dash */
-            case 0x2014: /* Em dash */
-            case 0x2212: /* Minus sign (same width as +) */
-            case 0x3000: /* Ideographic space */
-                c = ' ';
-                break;
-                /* Ignore these and just read something else */
-            case 0xAD: /* Soft hyphen */
-            case 0x2009: /* Thin space */
-            case 0x200A: /* Hair space */
-            case 0x200B: /* Zero width space */
-            case 0x200C: /* Zero width non-joiner */
-            case 0x200D: /* Zero width joiner */
-            case 0x2060: /* Word joiner */
-            case 0xFEFF: /* Zero width non-breaking space or Byte order mark */
-                goto read_again;
-            case 0x2018: /* Left single quotation mark */
-            case 0x2019: /* Right single quotation mark */
-            case 0x201A: /* Single low-9 quotation mark */
-            case 0x201B: /* Single high-reversed-9 quotation mark */
-            case 0x2039: /* < */
-            case 0x203A: /* > */
-            case 0x231C: /* Top left corner */
-            case 0x231D: /* Top right corner */
-            case 0x300C: /* Left corner bracket */
-            case 0x300D: /* Right corner bracket */
-            case 0xFE41: /* Presentation form for vertical left corner bracket */
-            case 0xFE42: /* Presentation form for vertical right corner bracket */
-            case 0xFF07: /* Fullwidth apostrophe */
-            case 0xFF62: /* Halfwidth left corner bracket */
-            case 0xFF63: /* Halfwidth right corner bracket */
-                c = '\'';
-                break;
-            case 0x00AB: /* << */
-            case 0x00BB: /* >> */
-            case 0x201C: /* Left double quotation mark */
-            case 0x201D: /* Right double quotation mark */
-            case 0x201E: /* Double low-9 quotation mark */
-            case 0x201F: /* Double high-reversed-9 quotation mark */
-            case 0x2E42: /* Double low-reversed-9 quotation mark */
-            case 0x300E: /* Left white corner bracket */
-            case 0x300F: /* Right white corner bracket */
-            case 0x301D: /* Reversed double prime quotation mark */
-            case 0x301E: /* Double prime quotation mark */
-            case 0x301F: /* Low double prime quotation mark */
-            case 0xFE43: /* Presentation form for vertical left white corner bracket */
-            case 0xFE44: /* Presentation form for vertical right white corner bracket */
-            case 0xFF02: /* Fullwidth quotation mark */
-                c = '\"';
-                break;
-        }
-        if (c >= 0x300 && c < 0x370) /* Combining diacritical marks */
-            goto read_again;
+    if (state->encoding > ASCII && c >= 0xA0 && c < 0x10000) {
+        const uint8_t *page = char_class_pages[c >> 8];
+        if (page != NULL)
+            switch (page[c & 0xFF]) {
+                case CHAR_SPACE:
+                    c = ' ';
+                    break;
+                case CHAR_IGNORED:
+                    goto read_again;
+                case CHAR_SINGLE_QUOTE:
+                    c = '\'';
+                    break;
+                case CHAR_DOUBLE_QUOTE:
+                    c = '\"';
+                    break;
+            }
     }
     if (c == '\n')
         return c;
@@ -418,11 +574,19 @@ read_again:
  * Initialize file parsing.
  *
  * @param state Pointer to state object
- * @param file FILE to use for input
+ * @param file FILE to use for input, or NULL to parse data instead
+ * @param data Input already in memory, used if file is NULL
+ * @param size Size of data
  * @param encoding
  */
-static void init_parser(parser_state_t *state, FILE *file, char encoding) {
+static void init_parser(parser_state_t *state, FILE *file, const uint8_t *data, size_t size, char encoding) {
     state->file = file;
+    if (file == NULL) {
+        state->next = data;
+        state->end = data + size;
+    } else
+        state->next = state->end = state->buffer;
+    state->ungot = -1;
     state->expecting = START;
     state->encoding = encoding;
     state->line_number = 1;
@@ -504,7 +668,7 @@ static void init_parser(parser_state_t *state, FILE *file, char encoding) {
             }
             if (encoding != UNKNOWN)
                 state->encoding = UTF8;
-            ungetc(c2, state->file);
+            state->next--;
         } else
             ERROR("File does not start with \"convfont\".");
     }
@@ -532,13 +696,31 @@ static void init_parser(parser_state_t *state, FILE *file, char encoding) {
  * Returns EOF if no characters can be read because the file is done.
  */
 static int get_next_line(parser_state_t *state) {
-    int c;
+    /* Always set before it's read, but gcc can't tell through the fast path. */
+    int c = 0;
     int len = MAX_LINE_LENGTH;
     state->line_number++;
     state->line_pos = 0;
     state->line_len = 0;
     char* buffer = state->line;
     do {
+        /* Copy runs of plain ASCII straight out of the read buffer. */
+        if (state->ungot < 0 && (state->encoding == UTF8 || state->encoding == ASCII) && len > 1) {
+            if (state->next == state->end)
+                refill(state);
+            size_t max = (size_t)(state->end - state->next);
+            if (max > (size_t)(len - 1))
+                max = (size_t)(len - 1);
+            size_t run = ascii_run_length(state->next, max);
+            if (run > 0) {
+                memcpy(buffer, state->next, run);
+                state->next += run;
+                buffer += run;
+                state->line_len += (int)run;
+                len -= (int)run;
+                c = (unsigned char)buffer[-1];
+            }
+        }
         if (--len <= 0) {
             /* Ignore rest of overlong line. */
             *buffer = '\0';
@@ -599,6 +781,7 @@ static char *eat_whitespace(char *str) {
 static int extract_field(char *input_string, bool mode, char *output, int max_len) {
     if (max_len <= 1) /* ? ? ? */
         throw_error(internal_error, "extract_field: max_len <= 1");
+    char *start = output;
     /* Eat leading whitespace */
     char *input = eat_whitespace(input_string);
     char c;
@@ -629,10 +812,10 @@ static int extract_field(char *input_string, bool mode, char *output, int max_le
         }
         *output++ = c;
     } while (true);
-    *output-- = '\0';
+    *output = '\0';
     /* Eat any possible trailing whitespace */
-    if (*output == ' ')
-        *output = '\0';
+    if (output > start && output[-1] == ' ')
+        output[-1] = '\0';
     return (int)(input - input_string);
 }
 
@@ -767,11 +950,56 @@ typedef struct {
     uint_fast8_t width;
 } bitmap_line_t;
 
+#ifdef TEXT_SSE2
+/**
+ * Classifies 16 characters at once.
+ * @return Bit n is set if character n is a set pixel, i.e. not '0', ' ', or NUL.
+ */
+static unsigned classify_pixels(__m128i chars) {
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('0')), _mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')));
+    blank = _mm_or_si128(blank, _mm_cmpeq_epi8(chars, _mm_setzero_si128()));
+    return ~(unsigned)_mm_movemask_epi8(blank) & 0xFFFF;
+}
+
+
+/**
+ * Mirrors a 32-bit word, so bit 0 becomes bit 31 and so on.
+ */
+static uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    return (x >> 16) | (x << 16);
+}
+#endif
+
+
 /**
  * Parses a line of text as a bitmap.
  */
 static bitmap_line_t parse_bitmap(char *text, bool double_width) {
     bitmap_line_t line = { 0, 0 };
+#ifdef TEXT_SSE2
+    /* Only the first 32 pixels fit into the bitmap, but every character still
+     * counts toward the width. */
+    size_t length = strlen(text);
+    line.width = (uint_fast8_t)(double_width ? (length + 1) / 2 : length);
+    uint8_t block[64] = { 0 };
+    memcpy(block, text, length < sizeof(block) ? length : sizeof(block));
+    __m128i a = _mm_loadu_si128((const __m128i *)block);
+    __m128i b = _mm_loadu_si128((const __m128i *)(block + 16));
+    if (double_width) {
+        /* Keep only the even lanes, and pack them down into 16 bytes. */
+        const __m128i even = _mm_set1_epi16(0x00FF);
+        __m128i c = _mm_loadu_si128((const __m128i *)(block + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(block + 48));
+        a = _mm_packus_epi16(_mm_and_si128(a, even), _mm_and_si128(b, even));
+        b = _mm_packus_epi16(_mm_and_si128(c, even), _mm_and_si128(d, even));
+    }
+    /* Pixel 0 is the most-significant bit. */
+    line.bitmap = reverse_bits(classify_pixels(a) | (classify_pixels(b) << 16));
+#else
     uint32_t bit = 0x80000000;
     for (char c = *text++; c != '\0'; c = *text++) {
         if (c != '0' && c != ' ')
@@ -781,6 +1009,7 @@ static bitmap_line_t parse_bitmap(char *text, bool double_width) {
         if (double_width && *text++ == '\0')
             break;
     }
+#endif
     return line;
 }
 
@@ -819,31 +1048,62 @@ static void is_error(parser_state_t *state, int val) {
 #define CHECK_FOR_ERROR(X) is_error(state, X)
 
 
+struct text_parser {
+    parser_state_t state;
+    /**
+     * Cache of glyph bitmap prior to being properly serialized.
+     */
+    uint32_t glyph_data[256];
+    /**
+     * Glyphs are collected here as they are read, in whatever order the file
+     * gives them, and only copied into a font once the whole file has been
+     * read and checked.  So a failed parse leaves nothing to free, and the
+     * finished font gets its bitmaps packed together in code point order.
+     */
+    uint8_t glyph_widths[256];
+    /**
+     * Length of each glyph's bitmap, or 0 if it has not been defined yet.
+     */
+    int glyph_lengths[256];
+    uint8_t glyph_bitmaps[256][255 * 3];
+    char error_message[sizeof(((error_trap_t *)NULL)->message)];
+};
+
+
+text_parser_t *text_parser_create(void) {
+    text_parser_t *parser = malloc(sizeof(text_parser_t));
+    if (parser == NULL)
+        return NULL;
+    parser->error_message[0] = '\0';
+    return parser;
+}
+
+
+void text_parser_destroy(text_parser_t *parser) {
+    free(parser);
+}
+
+
+const char *text_parser_message(const text_parser_t *parser) {
+    return parser->error_message;
+}
+
+
 /**
  * Parses a text-based font.
- * @param input The already-opened file to read from.
+ * @param in_file The already-opened file to read from, or NULL to use data.
+ * @param data The font in memory, used if in_file is NULL.
+ * @param size Size of data.
  * @return A pointer to a malloc()ed font.
  */
-fontlib_font_t *parse_text(FILE *in_file, char encoding) {
-    fontlib_font_t *target = malloc(sizeof(fontlib_font_t));
-    if (!target)
-        throw_error(malloc_failed, "parse_file: Failed to malloc fontlib_font_t.");
-    target->widths_table = calloc(256, sizeof(uint8_t));
-    if (!target->widths_table)
-        throw_error(malloc_failed, "parse_file: Failed to calloc widths table.");
-    target->bitmaps = calloc(256, sizeof(fontlib_bitmap_t *));
-    if (!target->bitmaps)
-        throw_error(malloc_failed, "parse_file: Failed to calloc bitmaps table.");
-    target->fontVersion = 0;
-    target->italic_space_adjust = target->space_above = target->space_below = 0;
-    target->weight = target->style = 0;
-    target->cap_height = target->x_height = target->baseline_height = 0;
-    static parser_state_t state_var;
-    parser_state_t *state = &state_var;
-    /**
-     * Cache of glyph bitmap prior to being properly serialized.
-     */
-    static uint32_t glyph_data[256];
+static fontlib_font_t *parse_text_font(text_parser_t *parser, FILE *in_file, const uint8_t *data, size_t size, char encoding) {
+    /* Metrics are gathered here until the real font can be allocated. */
+    fontlib_font_t metrics;
+    memset(&metrics, 0, sizeof(metrics));
+    memset(parser->glyph_lengths, 0, sizeof(parser->glyph_lengths));
+    parser_state_t *state = &parser->state;
+    uint32_t *glyph_data = parser->glyph_data;
+    init_string_lists();
     /**
      * Physical width of glyph currently being read.
      */
@@ -890,7 +1150,7 @@ fontlib_font_t *parse_text(FILE *in_file, char encoding) {
      */
     int r;
 
-    init_parser(state, in_file, encoding);
+    init_parser(state, in_file, data, size, encoding);
     
     /* Process header/metadata. */
     do {
@@ -1022,8 +1282,8 @@ fontlib_font_t *parse_text(FILE *in_file, char encoding) {
     /* Populate metrics. */
     if (height == -1)
         ERROR("Need to set font's height.");
-    target->height = (uint8_t)height;
-#define SET_OPTIONAL_PARAM(X) if (X >= 0) target->X = (uint8_t)X; else target->X = 0;
+    metrics.height = (uint8_t)height;
+#define SET_OPTIONAL_PARAM(X) if (X >= 0) metrics.X = (uint8_t)X; else metrics.X = 0;
     SET_OPTIONAL_PARAM(italic_space_adjust);
     SET_OPTIONAL_PARAM(space_above);
     SET_OPTIONAL_PARAM(space_below);
@@ -1044,7 +1304,7 @@ fontlib_font_t *parse_text(FILE *in_file, char encoding) {
         do {
             r = get_next_line(state);
             str = eat_whitespace(state->line);
-            if (r == EOF && (state_var.line_len == 0 || *eat_whitespace(state_var.line) == '\0'))
+            if (r == EOF && (state->line_len == 0 || *eat_whitespace(state->line) == '\0'))
                 if (got_tags)
                     ERROR("Unexpected end of file.");
                 else
@@ -1102,7 +1362,7 @@ fontlib_font_t *parse_text(FILE *in_file, char encoding) {
         } while (true);
         if (codepoint > 255)
             ERROR("Too many code points.");
-        if (target->bitmaps[codepoint] != NULL)
+        if (parser->glyph_lengths[codepoint] != 0)
             throw_errorf(text_parser_error, "Near line %i processing code point %i (0x02X): Duplicate code point definition.", state->line_number, codepoint, codepoint);
         glyph_width = 0;
         for (line = 0; line < height; line++) {
@@ -1130,13 +1390,9 @@ fontlib_font_t *parse_text(FILE *in_file, char encoding) {
         if (width > 24)
             throw_errorf(text_parser_error, "Near line %i processing code point %i (0x02X): Invalid width.", state->line_number, codepoint, codepoint);
         int columns = byte_columns(width);
-        target->widths_table[codepoint] = width;
-        fontlib_bitmap_t *bitmap_data = malloc(sizeof(fontlib_bitmap_t) + height * columns - sizeof(uint8_t));
-        if (bitmap_data == NULL)
-            throw_error(malloc_failed, "parse_file: Failed to allocate a bitmap.");
-        target->bitmaps[codepoint] = bitmap_data;
-        bitmap_data->length = height * columns;
-        uint8_t *ptr = bitmap_data->bytes;
+        parser->glyph_widths[codepoint] = (uint8_t)width;
+        parser->glyph_lengths[codepoint] = height * columns;
+        uint8_t *ptr = parser->glyph_bitmaps[codepoint];
         /* Order bytes into correct order in bitmap. */
         for (line = 0; line < height; line++) {
             uint32_t pixels = glyph_data[line];
@@ -1154,16 +1410,79 @@ fontlib_font_t *parse_text(FILE *in_file, char encoding) {
 file_done: /* We're done!  Clean up a bit. */
     if (!count)
         throw_error(text_parser_error, "Reached end of file without reading any glyphs.");
-    target->first_glyph = (uint8_t)first_glyph;
     codepoint = first_glyph;
     for (int i = count; i > 0; i--)
-        if (!target->bitmaps[codepoint++])
+        if (!parser->glyph_lengths[codepoint++])
             throw_errorf(text_parser_error, "Need definition for code point %i (0x%02X).", codepoint - 1, codepoint - 1);
-    target->total_glyphs = count;
-    /* Widths and bitmaps tables need to be trimmed. */
-    if (first_glyph) {
-        memmove(target->widths_table, target->widths_table + first_glyph, sizeof(target->widths_table[0]) * count);
-        memmove(target->bitmaps, target->bitmaps + first_glyph, sizeof(target->bitmaps[0]) * count);
-    }
+    /* Everything checks out, so now the font can be built in one go. */
+    fontlib_font_t *target = alloc_font(count, parser->glyph_lengths + first_glyph);
+    metrics.widths_table = target->widths_table;
+    metrics.bitmaps = target->bitmaps;
+    metrics.total_glyphs = (uint16_t)count;
+    metrics.first_glyph = (uint8_t)first_glyph;
+    *target = metrics;
+    memcpy(target->widths_table, parser->glyph_widths + first_glyph, count);
+    for (int i = 0; i < count; i++)
+        memcpy(target->bitmaps[i]->bytes, parser->glyph_bitmaps[first_glyph + i], target->bitmaps[i]->length);
     return target;
 }
+
+
+/**
+ * Shared by parse_text_r() and parse_text_buffer_r().
+ */
+static int parse_text_common(text_parser_t *parser, FILE *input, const uint8_t *data, size_t size, char encoding, fontlib_font_t **font) {
+    error_trap_t trap;
+    parser->error_message[0] = '\0';
+    push_error_trap(&trap);
+    if (setjmp(trap.jump)) {
+        memcpy(parser->error_message, trap.message, sizeof(parser->error_message));
+        return trap.code;
+    }
+    *font = parse_text_font(parser, input, data, size, encoding);
+    pop_error_trap(&trap);
+    return 0;
+}
+
+
+int parse_text_r(text_parser_t *parser, FILE *input, char encoding, fontlib_font_t **font) {
+    return parse_text_common(parser, input, NULL, 0, encoding, font);
+}
+
+
+int parse_text_buffer_r(text_parser_t *parser, const uint8_t *data, size_t size, char encoding, fontlib_font_t **font) {
+    return parse_text_common(parser, NULL, data, size, encoding, font);
+}
+
+
+/**
+ * Does the actual work of parse_text() and parse_text_buffer().
+ */
+static fontlib_font_t *parse_text_or_throw(FILE *input, const uint8_t *data, size_t size, char encoding) {
+    fontlib_font_t *font;
+    text_parser_t *parser = text_parser_create();
+    if (parser == NULL)
+        throw_error(malloc_failed, "parse_file: Failed to malloc parser state.");
+    int r = parse_text_common(parser, input, data, size, encoding, &font);
+    if (r != 0) {
+        char message[sizeof(parser->error_message)];
+        memcpy(message, parser->error_message, sizeof(message));
+        text_parser_destroy(parser);
+        throw_error(r, message[0] != '\0' ? message : NULL);
+    }
+    text_parser_destroy(parser);
+    return font;
+}
+
+/**
+ * Parses a text-based font.
+ * @param input The already-opened file to read from.
+ * @return A pointer to a malloc()ed font.
+ */
+fontlib_font_t *parse_text(FILE *input, char encoding) {
+    return parse_text_or_throw(input, NULL, 0, encoding);
+}
+
+fontlib_font_t *parse_text_buffer(const uint8_t *data, size_t size, char encoding) {
+    return parse_text_or_throw(NULL, data, size, encoding);
+}
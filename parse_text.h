@@ -1,13 +1,67 @@
 #pragma once
 
 #include <ctype.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "convfont.h"
 
+/**
+ * All of the state needed to parse a text font.  Parsers may be reused for
+ * any number of fonts, but each thread needs its own.
+ */
+typedef struct text_parser text_parser_t;
+
+/**
+ * Allocates a text parser.
+ * @return NULL if out of memory. */
+text_parser_t *text_parser_create(void);
+
+/**
+ * Frees a text parser. */
+void text_parser_destroy(text_parser_t *parser);
+
+/**
+ * Tag names, glyph tag names, and boolean values, for init_string_lists().
+ */
+extern string_list_t font_tags;
+extern string_list_t glyph_tags;
+extern string_list_t bools;
+
+/**
+ * Reentrant version of parse_text(); does not exit on error.
+ * @param parser The parser to use.
+ * @param input The already-opened file to read from.
+ * @param encoding The encoding to assume, or 0 to detect it.
+ * @param font Receives a pointer to a malloc()ed font on success.
+ * @return 0 on success, or an error_codes_t value on failure.  Use
+ * text_parser_message() to get a description. */
+int parse_text_r(text_parser_t *parser, FILE *input, char encoding, fontlib_font_t **font);
+
+/**
+ * Like parse_text_r(), but parses a font that is already in memory.
+ * @param parser The parser to use.
+ * @param data The contents of the font file.
+ * @param size Size of data in bytes.
+ * @param encoding The encoding to assume, or 0 to detect it.
+ * @param font Receives a pointer to a malloc()ed font on success.
+ * @return 0 on success, or an error_codes_t value on failure. */
+int parse_text_buffer_r(text_parser_t *parser, const uint8_t *data, size_t size, char encoding, fontlib_font_t **font);
+
+/**
+ * Describes the error from the most recent failed parse_text_r(). */
+const char *text_parser_message(const text_parser_t *parser);
+
 /**
  * Unpacks a font in text format into RAM.
  * @param input The already-opened file to read from.
  * @return A pointer to a malloc()ed font. */
 fontlib_font_t *parse_text(FILE *input, char encoding);
+
+/**
+ * Like parse_text(), but parses a font that is already in memory.
+ * @param data The contents of the font file.
+ * @param size Size of data in bytes.
+ * @return A pointer to a malloc()ed font. */
+fontlib_font_t *parse_text_buffer(const uint8_t *data, size_t size, char encoding);
@@ -3,19 +3,18 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "convfont.h"
+#include "pack_bitmaps.h"
 #include "serialize_font.h"
 
 /* Compute the total size, in bytes, a font will be.
  * @param font A pointer to the font to find the size of
+ * @param packed The layout of its bitmaps, from pack_bitmaps()
  * @return The size of the font */
-int compute_font_size(fontlib_font_t *font) {
-	int size = 18;
-	size += 3 * font->total_glyphs;
-	for (int i = 0; i < font->total_glyphs; i++)
-		size += font->bitmaps[i]->length;
-	return size;
+int compute_font_size(fontlib_font_t *font, const packed_bitmaps_t *packed) {
+	return 18 + 3 * font->total_glyphs + packed->size;
 }
 
 /* The idea of this system with an output callback with custom_data is that you
@@ -33,46 +32,94 @@ void output_ezword(uint32_t data, void(*output)(uint8_t byte, void *custom_data)
 	output((uint8_t)((data >> 16) & 255), custom_data);
 }
 
+/* Adapts a per-byte output callback to the span interface. */
+typedef struct {
+	void(*output)(uint8_t byte, void *custom_data);
+	void *custom_data;
+} byte_output_adapter_t;
+
+static void output_span_bytewise(const uint8_t *data, size_t length, void *custom_data) {
+	byte_output_adapter_t *adapter = (byte_output_adapter_t *)custom_data;
+	for (size_t i = 0; i < length; i++)
+		adapter->output(data[i], adapter->custom_data);
+}
+
 /* Serializes a FontLib font into bytes.
  * @param font The font to serialize
+ * @param packing How to pack its bitmaps
  * @param output A function to use to serialize the bytes. custom_data can be
  * any data you like, such a FILE struct.
  */
-void serialize_font(fontlib_font_t *font, void(*output)(uint8_t byte, void *custom_data), void *custom_data) {
+void serialize_font(fontlib_font_t *font, bitmap_packing_t packing, void(*output)(uint8_t byte, void *custom_data), void *custom_data) {
+	byte_output_adapter_t adapter = { output, custom_data };
+	serialize_font_spans(font, packing, output_span_bytewise, &adapter);
+}
+
+static void put_ezword(uint8_t *p, uint32_t data) {
+	p[0] = (uint8_t)(data & 255);
+	p[1] = (uint8_t)((data >> 8) & 255);
+	p[2] = (uint8_t)((data >> 16) & 255);
+}
+
+/* Serializes a FontLib font in as few pieces as possible: the header, the
+ * widths table, the offsets table, and then one span per bitmap stored.
+ * @param font The font to serialize
+ * @param packing How pack_bitmaps() lays out its bitmaps
+ * @param output Receives each span. custom_data can be any data you like.
+ */
+void serialize_font_spans(fontlib_font_t *font, bitmap_packing_t packing, output_span_t output, void *custom_data) {
+	packed_bitmaps_t packed;
+	pack_bitmaps(font, packing, NULL, &packed);
+	serialize_packed_font_spans(font, &packed, output, custom_data);
+}
+
+/* Serializes a FontLib font whose bitmaps have already been laid out.
+ * @param font The font to serialize
+ * @param packed The layout of the font's bitmaps, with any borrowed bitmaps'
+ * offsets filled in
+ * @param output Receives each span. custom_data can be any data you like.
+ */
+void serialize_packed_font_spans(fontlib_font_t *font, const packed_bitmaps_t *packed, output_span_t output, void *custom_data) {
+	uint8_t header[18];
+	uint8_t offsets[256 * 2];
+	uint8_t glyph[255 * 3];
 	/* Write header */
-	output(font->fontVersion, custom_data);
-	output(font->height, custom_data);
-	output(font->total_glyphs & 0xFF, custom_data);
-	output(font->first_glyph, custom_data);
+	header[0] = font->fontVersion;
+	header[1] = font->height;
+	header[2] = font->total_glyphs & 0xFF;
+	header[3] = font->first_glyph;
 	/* These values come from the data format */
-	output_ezword(18, output, custom_data);
-	int next_bitmap_offset = 18 + font->total_glyphs;
-	output_ezword(next_bitmap_offset, output, custom_data);
+	put_ezword(header + 4, 18);
+	int bitmaps_start = 18 + font->total_glyphs;
+	put_ezword(header + 7, bitmaps_start);
 	/* More header */
-	output(font->italic_space_adjust, custom_data);
-	output(font->space_above, custom_data);
-	output(font->space_below, custom_data);
-	output(font->weight, custom_data);
-	output(font->style, custom_data);
-	output(font->cap_height, custom_data);
-	output(font->x_height, custom_data);
-	output(font->baseline_height, custom_data);
+	header[10] = font->italic_space_adjust;
+	header[11] = font->space_above;
+	header[12] = font->space_below;
+	header[13] = font->weight;
+	header[14] = font->style;
+	header[15] = font->cap_height;
+	header[16] = font->x_height;
+	header[17] = font->baseline_height;
+	output(header, sizeof(header), custom_data);
 	/* Populate widths table */
-	for (int i = 0; i < font->total_glyphs; i++)
-		output(font->widths_table[i], custom_data);
+	output(font->widths_table, font->total_glyphs, custom_data);
 	/* Populate bitmaps offsets table */
-	next_bitmap_offset += font->total_glyphs * 2;
+	bitmaps_start += font->total_glyphs * 2;
+	if (bitmaps_start + packed->size >= MAX_APPVAR_SIZE)
+		throw_error(invalid_fnt, "Output font too big to fit!");
 	for (int i = 0; i < font->total_glyphs; i++) {
-		output_word((uint16_t)(next_bitmap_offset - 2 + (byte_columns(font->widths_table[i]) - 1)), output, custom_data);
-		next_bitmap_offset += font->bitmaps[i]->length;
-		if (next_bitmap_offset >= MAX_APPVAR_SIZE)
-			throw_error(invalid_fnt, "Output font too big to fit!");
+		int offset = bitmaps_start + packed->offsets[i] - 2 + (byte_columns(font->widths_table[i]) - 1);
+		if (packed->offsets[i] < 0 || offset > 0xFFFF)
+			throw_error(internal_error, "serialize_font: Bitmap offset out of range.");
+		offsets[i * 2] = (uint8_t)(offset & 255);
+		offsets[i * 2 + 1] = (uint8_t)(offset >> 8);
+	}
+	output(offsets, font->total_glyphs * 2, custom_data);
+	/* Write glyph bitmaps, leaving off whatever the previous one already
+	 * ended with. */
+	for (int i = 0; i < packed->piece_count; i++) {
+		int length = reverse_glyph_rows(font, packed->piece_glyphs[i], glyph);
+		output(glyph + packed->piece_skips[i], length - packed->piece_skips[i], custom_data);
 	}
-	/* Start writing glyph bitmaps */
-    for (int i = 0; i < font->total_glyphs; i++)
-        for (int y = 0; y < font->height; y++) {
-            int columns = byte_columns(font->widths_table[i]);
-            for (int c = columns - 1; c >= 0; c--)
-                output(font->bitmaps[i]->bytes[y * columns + c], custom_data);
-        }
 }
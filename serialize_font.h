@@ -1,11 +1,16 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "convfont.h"
+#include "pack_bitmaps.h"
 
-/* Compute the total size, in bytes, a font will be.
+/* Compute the total size, in bytes, a font will be.  Packing bitmaps is the
+ * slow part, so this takes a layout that has already been worked out.
  * @param font A pointer to the font to find the size of
+ * @param packed The layout of its bitmaps, from pack_bitmaps()
  * @return The size of the font */
-int compute_font_size(fontlib_font_t *font);
+int compute_font_size(fontlib_font_t *font, const packed_bitmaps_t *packed);
 
 /* The idea of this system with an output callback with custom_data is that you
  * can specify how exactly to output data.  For an output binary file, you can
@@ -17,7 +22,29 @@ void output_ezword(uint32_t data, void(*output)(uint8_t byte, void *custom_data)
 
 /* Serializes a FontLib font into bytes.
  * @param font The font to serialize
+ * @param packing How to pack its bitmaps
  * @param output A function to use to serialize the bytes. custom_data can be
  * any data you like, such a FILE struct.
  */
-void serialize_font(fontlib_font_t *font, void(*output)(uint8_t byte, void *custom_data), void *custom_data);
+void serialize_font(fontlib_font_t *font, bitmap_packing_t packing, void(*output)(uint8_t byte, void *custom_data), void *custom_data);
+
+/* Receives a contiguous run of serialized bytes.  data is only valid for the
+ * duration of the call. */
+typedef void(*output_span_t)(const uint8_t *data, size_t length, void *custom_data);
+
+/* Serializes a FontLib font in as few pieces as possible: the header, the
+ * widths table, the offsets table, and then one span per glyph.
+ * @param font The font to serialize
+ * @param packing How to pack its bitmaps
+ * @param output Receives each span. custom_data can be any data you like.
+ */
+void serialize_font_spans(fontlib_font_t *font, bitmap_packing_t packing, output_span_t output, void *custom_data);
+
+/* Serializes a FontLib font whose bitmaps have already been laid out, as in a
+ * font pack, where bitmaps can be borrowed from later fonts.
+ * @param font The font to serialize
+ * @param packed The layout of the font's bitmaps, with any borrowed bitmaps'
+ * offsets filled in
+ * @param output Receives each span. custom_data can be any data you like.
+ */
+void serialize_packed_font_spans(fontlib_font_t *font, const packed_bitmaps_t *packed, output_span_t output, void *custom_data);
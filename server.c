@@ -0,0 +1,542 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#endif
+
+#include "convfont.h"
+#include "job.h"
+#include "output_file.h"
+#include "server.h"
+#include "snapshot.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4996)
+#endif
+
+#ifdef _WIN32
+
+noreturn void run_server(const char *socket_name) {
+    (void)socket_name;
+    throw_error(bad_options, "--serve: Not available on Windows.");
+}
+
+void run_client(const char *socket_name, int argc, char *argv[]) {
+    (void)socket_name;
+    (void)argc;
+    (void)argv;
+    throw_error(bad_options, "--client: Not available on Windows.");
+}
+
+#else
+
+/* Every message, both ways, is a 32-bit little-endian byte count followed by
+ * that many bytes of fields.  Each field is a 32-bit little-endian length,
+ * that many bytes, and then a NUL that isn't counted, so that text fields can
+ * be used in place as strings.
+ *
+ * A request is the client's working directory, which must be absolute; the
+ * number of arguments, in decimal; the arguments; and then any number of
+ * inputs sent inline, each as its name and then its contents.  An input whose
+ * name matches an inline one is read from there, and any other is read by the
+ * server, from the client's directory if its name is relative.
+ *
+ * A reply is the exit code, in decimal; the error message, which is empty on
+ * success; and then every file the job wrote, each as its name and then its
+ * contents.  The server never writes files itself; that's left to the
+ * client. */
+#define MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+
+/* How long a connection may sit idle, in seconds, before the server gives up
+ * on it. */
+#define CONNECTION_TIMEOUT 10
+
+/* How many connections are served at once.  Jobs run one at a time anyway,
+ * so more threads would only let more idle clients pile up. */
+#define SERVER_THREADS 4
+
+typedef struct {
+    char *data;
+    size_t size;
+} field_t;
+
+typedef struct {
+    int count;
+    field_t *fields;
+    char *data;
+} message_t;
+
+/* A message being put together. */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    /* Set if malloc() failed or the message got too big. */
+    bool failed;
+} message_buffer_t;
+
+
+/*******************************************************************************
+*                                  MESSAGES                                    *
+*******************************************************************************/
+
+static bool send_all(int socket, const void *data, size_t size) {
+    const char *bytes = data;
+    while (size > 0) {
+        ssize_t sent = send(socket, bytes, size, 0);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+static bool receive_all(int socket, void *data, size_t size) {
+    char *bytes = data;
+    while (size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+static void put_size(uint8_t *dest, size_t size) {
+    for (int i = 0; i < 4; i++)
+        dest[i] = (uint8_t)(size >> (8 * i));
+}
+
+static size_t get_size(const uint8_t *source) {
+    size_t size = 0;
+    for (int i = 0; i < 4; i++)
+        size |= (size_t)source[i] << (8 * i);
+    return size;
+}
+
+/* Starts a message, leaving room for its byte count. */
+static void start_message(message_buffer_t *buffer) {
+    buffer->capacity = 4096;
+    buffer->data = malloc(buffer->capacity);
+    buffer->size = 4;
+    buffer->failed = buffer->data == NULL;
+}
+
+static void add_field(message_buffer_t *buffer, const void *data, size_t size) {
+    if (buffer->failed)
+        return;
+    size_t needed = buffer->size + 4 + size + 1;
+    if (needed > MAX_MESSAGE_SIZE + 4) {
+        buffer->failed = true;
+        return;
+    }
+    if (needed > buffer->capacity) {
+        size_t capacity = buffer->capacity;
+        while (capacity < needed)
+            capacity *= 2;
+        uint8_t *data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    put_size(buffer->data + buffer->size, size);
+    if (size > 0)
+        memcpy(buffer->data + buffer->size + 4, data, size);
+    buffer->data[buffer->size + 4 + size] = '\0';
+    buffer->size = needed;
+}
+
+static void add_string(message_buffer_t *buffer, const char *string) {
+    add_field(buffer, string, strlen(string));
+}
+
+static void add_number(message_buffer_t *buffer, int number) {
+    char text[16];
+    snprintf(text, sizeof(text), "%i", number);
+    add_string(buffer, text);
+}
+
+/* Sends a message and frees it.
+ * @return false if it couldn't be put together, or the other end has gone
+ * away. */
+static bool send_message(int socket, message_buffer_t *buffer) {
+    bool sent = false;
+    if (!buffer->failed) {
+        put_size(buffer->data, buffer->size - 4);
+        sent = send_all(socket, buffer->data, buffer->size);
+    }
+    free(buffer->data);
+    return sent;
+}
+
+/* @return false if the other end went away, took too long, or sent something
+ * that isn't a message, in which case there's nothing to free. */
+static bool receive_message(int socket, message_t *message) {
+    uint8_t header[4];
+    if (!receive_all(socket, header, sizeof(header)))
+        return false;
+    size_t size = get_size(header);
+    if (size > MAX_MESSAGE_SIZE)
+        return false;
+    message->data = malloc(size + 1);
+    if (message->data == NULL)
+        return false;
+    if (!receive_all(socket, message->data, size)) {
+        free(message->data);
+        return false;
+    }
+    /* Count the fields first, checking they fit as it goes. */
+    message->count = 0;
+    size_t position = 0;
+    while (size - position >= 5) {
+        size_t length = get_size((uint8_t *)message->data + position);
+        if (length > size - position - 5 || message->data[position + 4 + length] != '\0')
+            break;
+        position += 4 + length + 1;
+        message->count++;
+    }
+    message->fields = malloc(sizeof(field_t) * (message->count + 1));
+    if (position != size || message->fields == NULL) {
+        free(message->fields);
+        free(message->data);
+        return false;
+    }
+    position = 0;
+    for (int i = 0; i < message->count; i++) {
+        message->fields[i].size = get_size((uint8_t *)message->data + position);
+        message->fields[i].data = message->data + position + 4;
+        position += 4 + message->fields[i].size + 1;
+    }
+    return true;
+}
+
+static void free_message(message_t *message) {
+    free(message->fields);
+    free(message->data);
+}
+
+/* Fills in the address of a socket.  Throws if the name is too long. */
+static void make_address(const char *socket_name, const char *option, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_name) >= sizeof(address->sun_path))
+        throw_errorf(bad_options, "%s: Socket path too long.", option);
+    strcpy(address->sun_path, socket_name);
+}
+
+
+/*******************************************************************************
+*                                   SERVER                                     *
+*******************************************************************************/
+
+/* Fonts parsed for any client, which every connection's thread shares.  Jobs
+ * hold job_lock while they run, since neither this nor getopt() can be used
+ * by two threads at once; connections are only read from and replied to in
+ * parallel. */
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static snapshot_memory_t memory = { NULL, 0 };
+
+/* Does the actual work of serve_request() once the request has been taken
+ * apart. */
+static void run_request(conversion_job_t *job, int argc, char *argv[]) {
+    if (!parse_job_options(job, argc, argv))
+        throw_error(bad_options, "-h: Not valid with --client.");
+    /* Both of these would write files on the server's side. */
+    if (job->cache_directory != NULL)
+        throw_error(bad_options, "-k: Not valid with --client.");
+    if (job->snapshots)
+        throw_error(bad_options, "-u: Not valid with --client; the server keeps fonts in memory instead.");
+    run_job(job);
+}
+
+/* Works out how many arguments a request has.
+ * @return -1 if it isn't laid out as a request should be. */
+static int count_arguments(const message_t *request) {
+    char *end;
+    if (request->count < 2 || request->fields[0].data[0] != '/')
+        return -1;
+    long argc = strtol(request->fields[1].data, &end, 10);
+    if (end == request->fields[1].data || *end != '\0' || argc < 0 || argc > request->count - 2
+            || (request->count - 2 - argc) % 2 != 0)
+        return -1;
+    return (int)argc;
+}
+
+/* Reads one request, runs it, and sends back the reply. */
+static void serve_request(int connection) {
+    message_t request;
+    message_buffer_t reply;
+    conversion_job_t job;
+    job_files_t files;
+    if (!receive_message(connection, &request))
+        return;
+    start_message(&reply);
+    int argc = count_arguments(&request);
+    int inline_count = (request.count - 2 - argc) / 2;
+    char **argv = argc < 0 ? NULL : malloc(sizeof(char *) * (argc + 2));
+    memory_file_t *inputs = argc < 0 ? NULL : malloc(sizeof(memory_file_t) * (inline_count + 1));
+    if (argv == NULL || inputs == NULL) {
+        add_number(&reply, argc < 0 ? bad_options : malloc_failed);
+        add_string(&reply, argc < 0 ? "--client: Malformed request." : "--serve: Failed to malloc request.");
+        send_message(connection, &reply);
+        free(argv);
+        free(inputs);
+        free_message(&request);
+        return;
+    }
+    argv[0] = "convfont";
+    for (int i = 0; i < argc; i++)
+        argv[i + 1] = request.fields[i + 2].data;
+    argv[argc + 1] = NULL;
+    for (int i = 0; i < inline_count; i++) {
+        field_t *input = &request.fields[2 + argc + 2 * i];
+        inputs[i].name = input[0].data;
+        inputs[i].data = (uint8_t *)input[1].data;
+        inputs[i].size = input[1].size;
+    }
+    files.input_count = inline_count;
+    files.inputs = inputs;
+    files.output_count = 0;
+    init_job(&job);
+    job.input_directory = request.fields[0].data;
+    job.memory_files = &files;
+    job.snapshot_memory = &memory;
+
+    pthread_mutex_lock(&job_lock);
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        run_request(&job, argc + 1, argv);
+        pop_error_trap(&trap);
+    }
+    free_job(&job);
+    pthread_mutex_unlock(&job_lock);
+    if (trap.code != 0)
+        fprintf(stderr, "ERROR: %s\n", trap.message);
+
+    add_number(&reply, trap.code);
+    add_string(&reply, trap.message);
+    /* A job that failed partway leaves nothing for the client to write. */
+    for (int i = 0; i < files.output_count && trap.code == 0; i++) {
+        add_string(&reply, files.outputs[i].name);
+        add_field(&reply, files.outputs[i].data, files.outputs[i].size);
+    }
+    if (reply.failed) {
+        free(reply.data);
+        start_message(&reply);
+        add_number(&reply, internal_error);
+        add_string(&reply, "--serve: Output too large to send.");
+    }
+    send_message(connection, &reply);
+    free_job_files(&files);
+    free(argv);
+    free(inputs);
+    free_message(&request);
+}
+
+/* Serves connections one after another, for as long as the server runs.
+ * Several of these run at once, so a slow client only holds up its own
+ * thread, and connections beyond that wait to be accepted. */
+static void *serve_connections(void *argument) {
+    int listener = (int)(intptr_t)argument;
+    struct timeval timeout = { CONNECTION_TIMEOUT, 0 };
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw_error(connection_failed, "--serve: Cannot accept connections.");
+        }
+        /* A client that connects and then never sends, or never reads its
+         * reply, is dropped instead of keeping its thread forever. */
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_request(connection);
+        fflush(stdout);
+        close(connection);
+    }
+    return NULL;
+}
+
+noreturn void run_server(const char *socket_name) {
+    struct sockaddr_un address;
+    struct stat status;
+    make_address(socket_name, "--serve", &address);
+    /* A server that has gone away leaves its socket behind, but anything
+     * that isn't a socket is left well alone. */
+    if (lstat(socket_name, &status) == 0) {
+        if (!S_ISSOCK(status.st_mode))
+            throw_error(bad_options, "--serve: Something other than a socket is already there.");
+        unlink(socket_name);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        throw_error(connection_failed, "--serve: Cannot create socket.");
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        close(listener);
+        throw_error(connection_failed, "--serve: Cannot listen on socket.");
+    }
+    /* A client that gives up before its reply shouldn't take the server with
+     * it. */
+    signal(SIGPIPE, SIG_IGN);
+    printf("Serving on %s.\n", socket_name);
+    fflush(stdout);
+    /* This thread is one of the pool too. */
+    for (int i = 1; i < SERVER_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connections, (void *)(intptr_t)listener) != 0)
+            break;
+        pthread_detach(thread);
+    }
+    serve_connections((void *)(intptr_t)listener);
+    throw_error(internal_error, "--serve: Stopped serving.");
+}
+
+
+/*******************************************************************************
+*                                   CLIENT                                     *
+*******************************************************************************/
+
+/* Reads all of stdin, for an input named -.
+ * @return false if malloc() failed or stdin couldn't be read. */
+static bool read_stdin(memory_file_t *file) {
+    size_t capacity = 4096;
+    file->name = "-";
+    file->size = 0;
+    file->data = malloc(capacity);
+    while (file->data != NULL) {
+        file->size += fread(file->data + file->size, 1, capacity - file->size, stdin);
+        if (file->size < capacity)
+            return !ferror(stdin);
+        uint8_t *data = realloc(file->data, capacity *= 2);
+        if (data == NULL)
+            free(file->data);
+        file->data = data;
+    }
+    return false;
+}
+
+/* Writes each file in a reply where it belongs, as a normal run would have. */
+static void write_reply_files(const message_t *reply) {
+    for (int i = 2; i + 1 < reply->count; i += 2) {
+        output_file_t output;
+        const char *name = reply->fields[i].data;
+        if (!open_output_file(name, &output))
+            throw_errorf(bad_outfile, "%s: Cannot open output file.", name);
+        fwrite(reply->fields[i + 1].data, 1, reply->fields[i + 1].size, output.file);
+        switch (close_output_file(&output)) {
+            case output_failed:
+                throw_errorf(bad_outfile, "%s: Cannot write output file.", name);
+            case output_unchanged:
+                if (verbosity >= 1)
+                    printf("%s is unchanged, so it was left alone.\n", name);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* Sends a request to the server and waits for the reply, which the caller
+ * has to free.  The request is freed either way. */
+static void exchange(const struct sockaddr_un *address, message_buffer_t *request, message_t *reply) {
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) {
+        free(request->data);
+        throw_error(connection_failed, "--client: Cannot create socket.");
+    }
+    if (connect(connection, (const struct sockaddr *)address, sizeof(struct sockaddr_un)) != 0) {
+        close(connection);
+        free(request->data);
+        throw_error(connection_failed, "--client: Cannot connect to server.");
+    }
+    bool sent = send_message(connection, request);
+    if (!sent || !receive_message(connection, reply)) {
+        close(connection);
+        throw_error(connection_failed, "--client: Server went away.");
+    }
+    close(connection);
+    if (reply->count < 2 || reply->count % 2 != 0) {
+        free_message(reply);
+        throw_error(connection_failed, "--client: Server sent a malformed reply.");
+    }
+}
+
+void run_client(const char *socket_name, int argc, char *argv[]) {
+    struct sockaddr_un address;
+    conversion_job_t job;
+    message_buffer_t request;
+    message_t reply;
+    memory_file_t standard_input = { NULL, NULL, 0 };
+    char directory[4096];
+    char message[256];
+    make_address(socket_name, "--client", &address);
+    char **options = malloc(sizeof(char *) * (argc + 2));
+    if (options == NULL)
+        throw_error(malloc_failed, "--client: Failed to malloc request.");
+    /* The options are parsed here too, both to catch mistakes without a round
+     * trip and to find any input that has to be sent along. */
+    options[0] = "convfont";
+    memcpy(options + 1, argv, sizeof(char *) * argc);
+    options[argc + 1] = NULL;
+    init_job(&job);
+    bool parsed = parse_job_options(&job, argc + 1, options);
+    free(options);
+    if (!parsed)
+        throw_error(bad_options, "-h: Not valid with --client.");
+    verbosity = job.verbosity;
+    if (getcwd(directory, sizeof(directory)) == NULL)
+        throw_error(bad_options, "--client: Cannot get working directory.");
+    for (int i = 0; i < job.input_count; i++)
+        if (!strcmp(job.inputs[i].file_name, "-") && standard_input.data == NULL && !read_stdin(&standard_input))
+            throw_error(bad_infile, "-: Cannot read standard input.");
+
+    start_message(&request);
+    add_string(&request, directory);
+    add_number(&request, argc);
+    for (int i = 0; i < argc; i++)
+        add_string(&request, argv[i]);
+    if (standard_input.data != NULL) {
+        add_string(&request, standard_input.name);
+        add_field(&request, standard_input.data, standard_input.size);
+        free(standard_input.data);
+    }
+    exchange(&address, &request, &reply);
+    int code = atoi(reply.fields[0].data);
+    snprintf(message, sizeof(message), "%s", reply.fields[1].data);
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        write_reply_files(&reply);
+        pop_error_trap(&trap);
+    } else {
+        free_message(&reply);
+        rethrow_error(&trap);
+    }
+    free_message(&reply);
+    if (code != 0)
+        throw_error(code, message[0] != '\0' ? message : NULL);
+}
+
+#endif
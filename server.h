@@ -0,0 +1,31 @@
+#pragma once
+
+#include "convfont.h"
+
+/* A conversion server, so that tools which convert the same fonts over and
+ * over, such as an editor showing a preview, don't pay for starting convfont
+ * and parsing every font each time.  The server listens on a Unix domain
+ * socket.  A request carries a job's options and can carry input files
+ * inline; inputs it doesn't carry are read by path.  The reply carries the
+ * job's error code and message and every file it wrote, so the server itself
+ * never writes anything.  Fonts it has parsed are kept in memory and reused
+ * for as long as their sources don't change.  A small, fixed pool of threads
+ * serves connections, any more waiting their turn, and one that sits idle too
+ * long is dropped; jobs themselves still run one at a time.  Neither end is
+ * available on Windows. */
+
+/* Serves conversion requests until the process is killed.  A stale socket
+ * left behind by an earlier server is replaced.  Errors starting the server
+ * are thrown.
+ * @param socket_name Path of the socket to listen on. */
+noreturn void run_server(const char *socket_name);
+
+/* Has a server run one job and reports the outcome as if the job had been run
+ * here: the files it wrote are written here, and an error is thrown with the
+ * job's error code and message.  An input named - is read from stdin and sent
+ * along with the request.
+ * @param socket_name Path of the server's socket.
+ * @param argc Number of arguments.
+ * @param argv The job's options, as on the command line but without the
+ * program name. */
+void run_client(const char *socket_name, int argc, char *argv[]);
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "convfont.h"
+#include "cache.h"
+#include "file_buffer.h"
+#include "output_file.h"
+#include "parse_fnt.h"
+#include "snapshot.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4996)
+#endif
+
+/* A snapshot is the magic number, the source's key, and the number of fonts;
+ * then for each font its glyph count, its header fields, its widths table,
+ * the length of each bitmap, and the bitmaps themselves.  Everything is
+ * little-endian.  Change the magic number if this ever changes. */
+#define SNAPSHOT_MAGIC "CFSNAP01"
+#define SNAPSHOT_MAGIC_SIZE 8
+#define SNAPSHOT_HEADER_SIZE (SNAPSHOT_MAGIC_SIZE + 8 + 2)
+#define FONT_HEADER_SIZE 12
+
+/* Makes the name of a source's snapshot.
+ * @return A malloc()ed string, or NULL if malloc() failed. */
+static char *snapshot_name(const char *source_name) {
+    size_t length = strlen(source_name) + 10;
+    char *name = malloc(length);
+    if (name != NULL)
+        snprintf(name, length, "%s.snapshot", source_name);
+    return name;
+}
+
+/* Works out what a snapshot of the source as it is now would be keyed with.
+ * @return false if the source can't be read. */
+static bool source_key(const char *source_name, int type, uint64_t *key) {
+    *key = hash_cache_int(start_cache_key(), type);
+    return hash_cache_file(key, source_name);
+}
+
+static uint8_t *put_word(uint8_t *dest, unsigned int data) {
+    *dest++ = (uint8_t)(data & 255);
+    *dest++ = (uint8_t)((data >> 8) & 255);
+    return dest;
+}
+
+static unsigned int get_word(const uint8_t *source) {
+    return source[0] | (source[1] << 8);
+}
+
+/* Does the work of load_snapshot() once the snapshot is in memory. */
+static int read_snapshot(const uint8_t *data, size_t size, uint64_t key, fontlib_font_t **fonts, int max_fonts) {
+    size_t position = SNAPSHOT_HEADER_SIZE;
+    int lengths[256];
+    int count;
+    if (size < SNAPSHOT_HEADER_SIZE || memcmp(data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+        return -1;
+    for (int i = 0; i < 8; i++)
+        if (data[SNAPSHOT_MAGIC_SIZE + i] != (uint8_t)(key >> (8 * i)))
+            return -1;
+    count = (int)get_word(data + SNAPSHOT_MAGIC_SIZE + 8);
+    if (count < 1 || count > max_fonts)
+        return -1;
+    for (int f = 0; f < count; f++) {
+        const uint8_t *header = data + position;
+        int total_glyphs;
+        size_t bitmaps_size = 0;
+        if (size - position < FONT_HEADER_SIZE)
+            break;
+        total_glyphs = (int)get_word(header);
+        position += FONT_HEADER_SIZE;
+        /* The same limits the parsers enforce, since everything downstream
+         * counts on them. */
+        if (total_glyphs < 1 || header[3] + total_glyphs > 256 || header[2] == 0
+                || size - position < (size_t)total_glyphs * 3)
+            break;
+        const uint8_t *widths = data + position;
+        position += total_glyphs;
+        for (int i = 0; i < total_glyphs; i++, position += 2) {
+            lengths[i] = (int)get_word(data + position);
+            if (widths[i] > 24 || lengths[i] != header[2] * byte_columns(widths[i]))
+                break;
+            bitmaps_size += lengths[i];
+        }
+        if (position != (size_t)(widths - data) + total_glyphs * 3 || size - position < bitmaps_size)
+            break;
+        fontlib_font_t *font = alloc_font(total_glyphs, lengths);
+        font->fontVersion = 0;
+        font->first_glyph = header[3];
+        font->height = header[2];
+        font->italic_space_adjust = header[4];
+        font->space_above = header[5];
+        font->space_below = header[6];
+        font->weight = header[7];
+        font->style = header[8];
+        font->cap_height = header[9];
+        font->x_height = header[10];
+        font->baseline_height = header[11];
+        memcpy(font->widths_table, widths, total_glyphs);
+        for (int i = 0; i < total_glyphs; i++) {
+            memcpy(font->bitmaps[i]->bytes, data + position, lengths[i]);
+            position += lengths[i];
+        }
+        fonts[f] = font;
+        if (f == count - 1 && position == size)
+            return count;
+    }
+    /* Anything that doesn't add up means the snapshot is damaged; it'll be
+     * replaced once the source has been parsed again. */
+    for (int f = 0; f < count && fonts[f] != NULL; f++) {
+        free_fnt(fonts[f]);
+        fonts[f] = NULL;
+    }
+    return -1;
+}
+
+/* Calls read_snapshot(), making sure no fonts are left behind if it throws. */
+static int read_snapshot_fonts(const uint8_t *data, size_t size, uint64_t key, fontlib_font_t **fonts, int max_fonts) {
+    int count;
+    for (int f = 0; f < max_fonts; f++)
+        fonts[f] = NULL;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        count = read_snapshot(data, size, key, fonts, max_fonts);
+        pop_error_trap(&trap);
+    } else {
+        for (int f = 0; f < max_fonts && fonts[f] != NULL; f++) {
+            free_fnt(fonts[f]);
+            fonts[f] = NULL;
+        }
+        rethrow_error(&trap);
+    }
+    return count;
+}
+
+/* Serializes fonts as a snapshot.
+ * @return A malloc()ed image, or NULL if malloc() failed. */
+static uint8_t *build_snapshot(uint64_t key, fontlib_font_t **fonts, int count, size_t *size_out) {
+    size_t size = SNAPSHOT_HEADER_SIZE;
+    for (int f = 0; f < count; f++) {
+        size += FONT_HEADER_SIZE + fonts[f]->total_glyphs * 3;
+        for (int i = 0; i < fonts[f]->total_glyphs; i++)
+            size += fonts[f]->bitmaps[i]->length;
+    }
+    uint8_t *image = malloc(size);
+    if (image == NULL)
+        return NULL;
+    uint8_t *dest = image;
+    memcpy(dest, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    dest += SNAPSHOT_MAGIC_SIZE;
+    for (int i = 0; i < 8; i++)
+        *dest++ = (uint8_t)(key >> (8 * i));
+    dest = put_word(dest, (unsigned int)count);
+    for (int f = 0; f < count; f++) {
+        fontlib_font_t *font = fonts[f];
+        dest = put_word(dest, font->total_glyphs);
+        *dest++ = font->height;
+        *dest++ = font->first_glyph;
+        *dest++ = font->italic_space_adjust;
+        *dest++ = font->space_above;
+        *dest++ = font->space_below;
+        *dest++ = font->weight;
+        *dest++ = font->style;
+        *dest++ = font->cap_height;
+        *dest++ = font->x_height;
+        *dest++ = font->baseline_height;
+        memcpy(dest, font->widths_table, font->total_glyphs);
+        dest += font->total_glyphs;
+        for (int i = 0; i < font->total_glyphs; i++)
+            dest = put_word(dest, (unsigned int)font->bitmaps[i]->length);
+        for (int i = 0; i < font->total_glyphs; i++) {
+            memcpy(dest, font->bitmaps[i]->bytes, font->bitmaps[i]->length);
+            dest += font->bitmaps[i]->length;
+        }
+    }
+    *size_out = size;
+    return image;
+}
+
+int load_snapshot(const char *source_name, int type, fontlib_font_t **fonts, int max_fonts) {
+    uint64_t key;
+    file_buffer_t buffer;
+    int count;
+    if (!source_key(source_name, type, &key))
+        return -1;
+    char *name = snapshot_name(source_name);
+    if (name == NULL)
+        return -1;
+    FILE *file = fopen(name, "rb");
+    free(name);
+    if (file == NULL)
+        return -1;
+    bool loaded = map_file(file, &buffer);
+    fclose(file);
+    if (!loaded)
+        return -1;
+    error_trap_t trap;
+    push_error_trap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        count = read_snapshot_fonts(buffer.data, buffer.size, key, fonts, max_fonts);
+        pop_error_trap(&trap);
+    } else {
+        unmap_file(&buffer);
+        rethrow_error(&trap);
+    }
+    unmap_file(&buffer);
+    return count;
+}
+
+bool save_snapshot(const char *source_name, int type, fontlib_font_t **fonts, int count) {
+    uint64_t key;
+    size_t size;
+    if (count < 1 || !source_key(source_name, type, &key))
+        return false;
+    uint8_t *image = build_snapshot(key, fonts, count, &size);
+    if (image == NULL)
+        return false;
+
+    /* Other jobs may be reading the same snapshot, so it's only ever
+     * replaced whole. */
+    output_file_t output;
+    bool saved = false;
+    char *name = snapshot_name(source_name);
+    if (name != NULL && open_output_file(name, &output)) {
+        if (fwrite(image, 1, size, output.file) == size)
+            saved = close_output_file(&output) != output_failed;
+        else
+            discard_output_file(&output);
+    }
+    free(name);
+    free(image);
+    return saved;
+}
+
+
+/*******************************************************************************
+*                                   MEMORY                                     *
+*******************************************************************************/
+
+struct remembered_snapshot {
+    uint64_t key;
+    size_t size;
+    uint8_t *image;
+    struct remembered_snapshot *next;
+};
+
+/* Does the actual work of recall_snapshot() once the source is hashed. */
+static int recall_key(snapshot_memory_t *memory, uint64_t key, fontlib_font_t **fonts, int max_fonts) {
+    remembered_snapshot_t **link = &memory->first;
+    for (remembered_snapshot_t *entry = memory->first; entry != NULL; link = &entry->next, entry = entry->next) {
+        if (entry->key != key)
+            continue;
+        /* Move it to the front, so the least recently used is always last. */
+        *link = entry->next;
+        entry->next = memory->first;
+        memory->first = entry;
+        return read_snapshot_fonts(entry->image, entry->size, key, fonts, max_fonts);
+    }
+    return -1;
+}
+
+int recall_snapshot(snapshot_memory_t *memory, const char *source_name, int type, fontlib_font_t **fonts, int max_fonts) {
+    uint64_t key;
+    if (memory->first == NULL || !source_key(source_name, type, &key))
+        return -1;
+    return recall_key(memory, key, fonts, max_fonts);
+}
+
+int recall_snapshot_data(snapshot_memory_t *memory, const uint8_t *data, size_t size, int type, fontlib_font_t **fonts, int max_fonts) {
+    if (memory->first == NULL)
+        return -1;
+    return recall_key(memory, hash_cache_bytes(hash_cache_int(start_cache_key(), type), data, size), fonts, max_fonts);
+}
+
+/* Does the actual work of remember_snapshot() once the source is hashed. */
+static void remember_key(snapshot_memory_t *memory, uint64_t key, fontlib_font_t **fonts, int count) {
+    remembered_snapshot_t *entry;
+    if (memory->count >= MAX_REMEMBERED_SNAPSHOTS) {
+        remembered_snapshot_t **link = &memory->first;
+        while ((*link)->next != NULL)
+            link = &(*link)->next;
+        entry = *link;
+        *link = NULL;
+        free(entry->image);
+        memory->count--;
+    } else {
+        entry = malloc(sizeof(remembered_snapshot_t));
+        if (entry == NULL)
+            return;
+    }
+    entry->image = build_snapshot(key, fonts, count, &entry->size);
+    if (entry->image == NULL) {
+        free(entry);
+        return;
+    }
+    entry->key = key;
+    entry->next = memory->first;
+    memory->first = entry;
+    memory->count++;
+}
+
+void remember_snapshot(snapshot_memory_t *memory, const char *source_name, int type, fontlib_font_t **fonts, int count) {
+    uint64_t key;
+    if (count < 1 || !source_key(source_name, type, &key))
+        return;
+    remember_key(memory, key, fonts, count);
+}
+
+void remember_snapshot_data(snapshot_memory_t *memory, const uint8_t *data, size_t size, int type, fontlib_font_t **fonts, int count) {
+    if (count < 1)
+        return;
+    remember_key(memory, hash_cache_bytes(hash_cache_int(start_cache_key(), type), data, size), fonts, count);
+}
+
+void forget_snapshots(snapshot_memory_t *memory) {
+    while (memory->first != NULL) {
+        remembered_snapshot_t *entry = memory->first;
+        memory->first = entry->next;
+        free(entry->image);
+        free(entry);
+    }
+    memory->count = 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "convfont.h"
+
+/* Snapshots, for -u, save the fonts parsed from a source file in a form that
+ * loads with no parsing at all.  A snapshot is kept next to its source, with
+ * .snapshot added to the name, and records a hash of the source so that it is
+ * ignored once the source changes.  Metrics given on the command line are
+ * applied after loading, so one snapshot serves every variant of a font. */
+
+/* Loads the fonts saved in a source file's snapshot, if it has one that is
+ * still current.
+ * @param source_name The source file.
+ * @param type What kind of source it is, as an input_types_t; a snapshot only
+ * matches if the type does too.
+ * @param fonts Receives the fonts, each to be released with free_fnt().
+ * @param max_fonts Number of slots in fonts.
+ * @return Number of fonts loaded, or -1 if there's no usable snapshot, in
+ * which case the source has to be parsed. */
+int load_snapshot(const char *source_name, int type, fontlib_font_t **fonts, int max_fonts);
+
+/* Saves the fonts parsed from a source file as its snapshot.  A snapshot is
+ * only a shortcut, so failing to save one isn't an error.
+ * @param source_name The source file.
+ * @param type What kind of source it is.
+ * @param fonts The fonts, exactly as parsed, with no metrics applied.
+ * @param count Number of fonts.
+ * @return false if the snapshot couldn't be saved. */
+bool save_snapshot(const char *source_name, int type, fontlib_font_t **fonts, int count);
+
+/* Snapshots kept in memory instead of on disk, for a process that converts
+ * the same fonts over and over, such as --serve.  Only the most recently used
+ * are kept.  A snapshot_memory_t must only be used by one thread at a time.
+ * Start one off with all its fields zero. */
+#define MAX_REMEMBERED_SNAPSHOTS 64
+
+typedef struct remembered_snapshot remembered_snapshot_t;
+
+typedef struct {
+    remembered_snapshot_t *first;
+    int count;
+} snapshot_memory_t;
+
+/* Like load_snapshot(), but from memory.
+ * @return Number of fonts loaded, or -1 if none are remembered for the source
+ * as it is now. */
+int recall_snapshot(snapshot_memory_t *memory, const char *source_name, int type, fontlib_font_t **fonts, int max_fonts);
+
+/* Like save_snapshot(), but to memory, forgetting the least recently used
+ * snapshot if there are too many.  Failure is silently ignored. */
+void remember_snapshot(snapshot_memory_t *memory, const char *source_name, int type, fontlib_font_t **fonts, int count);
+
+/* Like recall_snapshot(), for a source that is already in memory. */
+int recall_snapshot_data(snapshot_memory_t *memory, const uint8_t *data, size_t size, int type, fontlib_font_t **fonts, int max_fonts);
+
+/* Like remember_snapshot(), for a source that is already in memory. */
+void remember_snapshot_data(snapshot_memory_t *memory, const uint8_t *data, size_t size, int type, fontlib_font_t **fonts, int count);
+
+/* Frees every snapshot held in memory. */
+void forget_snapshots(snapshot_memory_t *memory);
@@ -0,0 +1,69 @@
+/* Checks transpose_glyph() against the per-byte loop parse_fnt() used to use.
+ * The makefile links this against transpose.c built with several sets of
+ * flags so that each of the SIMD paths and the scalar fallback gets run. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transpose.h"
+
+#define MAX_HEIGHT 255
+#define MAX_COLUMNS 3
+/* Extra space around the buffers so unaligned starts and overruns show up. */
+#define SLACK 64
+#define GUARD 0xA5
+
+static void reference_transpose(uint8_t *dest, const uint8_t *source, int columns, int height) {
+    for (int c = 0; c < columns; c++) /* Not a secret message */
+        for (int y = 0; y < height; y++)
+            dest[y * columns + c] = *source++;
+}
+
+int main(void) {
+    static uint8_t source[MAX_HEIGHT * MAX_COLUMNS + SLACK];
+    static uint8_t expected[MAX_HEIGHT * MAX_COLUMNS];
+    static uint8_t actual[MAX_HEIGHT * MAX_COLUMNS + 2 * SLACK];
+    unsigned int seed = 1;
+    int failures = 0;
+    int cases = 0;
+
+    for (int columns = 1; columns <= MAX_COLUMNS; columns++)
+        for (int height = 1; height <= MAX_HEIGHT; height++)
+            for (int offset = 0; offset < 2; offset++) {
+                int size = columns * height;
+                const uint8_t *in = source + offset;
+                uint8_t *out = actual + SLACK + offset;
+                for (int i = 0; i < (int)sizeof(source); i++) {
+                    seed = seed * 1103515245 + 12345;
+                    source[i] = (uint8_t)(seed >> 16);
+                }
+                memset(actual, GUARD, sizeof(actual));
+                reference_transpose(expected, in, columns, height);
+                transpose_glyph(out, in, columns, height);
+                cases++;
+                if (memcmp(out, expected, size)) {
+                    int i = 0;
+                    while (out[i] == expected[i])
+                        i++;
+                    fprintf(stderr, "columns %d, height %d, offset %d: byte %d is %02X, expected %02X\n",
+                        columns, height, offset, i, out[i], expected[i]);
+                    failures++;
+                    continue;
+                }
+                for (int i = 0; i < (int)sizeof(actual); i++)
+                    if ((actual + i < out || actual + i >= out + size) && actual[i] != GUARD) {
+                        fprintf(stderr, "columns %d, height %d, offset %d: wrote outside the glyph\n",
+                            columns, height, offset);
+                        failures++;
+                        break;
+                    }
+            }
+
+    if (failures) {
+        fprintf(stderr, "%s: %d of %d cases failed\n", TEST_VARIANT, failures, cases);
+        return EXIT_FAILURE;
+    }
+    printf("%s: %d cases passed\n", TEST_VARIANT, cases);
+    return EXIT_SUCCESS;
+}
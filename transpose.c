@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <string.h>
+
+/* Define TRANSPOSE_SCALAR to build only the plain loops, e.g. to test them. */
+#ifndef TRANSPOSE_SCALAR
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSPOSE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#define TRANSPOSE_SSSE3
+#include <tmmintrin.h>
+#endif
+#ifdef __AVX2__
+#define TRANSPOSE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#include "convfont.h"
+#include "transpose.h"
+
+/* Two columns is just interleaving two byte arrays. */
+static void transpose_2(uint8_t *dest, const uint8_t *left, const uint8_t *right, int height) {
+    int y = 0;
+#ifdef TRANSPOSE_AVX2
+    for (; y + 32 <= height; y += 32, dest += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(left + y));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(right + y));
+        /* unpack works within 128-bit lanes, so fix up the lane order after. */
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+        _mm256_storeu_si256((__m256i *)dest, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dest + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+#endif
+#ifdef TRANSPOSE_SSE2
+    for (; y + 16 <= height; y += 16, dest += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(left + y));
+        __m128i b = _mm_loadu_si128((const __m128i *)(right + y));
+        _mm_storeu_si128((__m128i *)dest, _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(dest + 16), _mm_unpackhi_epi8(a, b));
+    }
+#endif
+    for (; y < height; y++) {
+        *dest++ = left[y];
+        *dest++ = right[y];
+    }
+}
+
+#ifdef TRANSPOSE_SSSE3
+/* Shuffle masks for spreading 16 bytes of one column across 48 output bytes.
+ * -1 (0x80) lanes are zeroed by pshufb. */
+#define X -1
+static const int8_t shuffle_3[3][3][16] = {
+    {   /* Column 0 */
+        { 0, X, X, 1, X, X, 2, X, X, 3, X, X, 4, X, X, 5 },
+        { X, X, 6, X, X, 7, X, X, 8, X, X, 9, X, X, 10, X },
+        { X, 11, X, X, 12, X, X, 13, X, X, 14, X, X, 15, X, X },
+    }, { /* Column 1 */
+        { X, 0, X, X, 1, X, X, 2, X, X, 3, X, X, 4, X, X },
+        { 5, X, X, 6, X, X, 7, X, X, 8, X, X, 9, X, X, 10 },
+        { X, X, 11, X, X, 12, X, X, 13, X, X, 14, X, X, 15, X },
+    }, { /* Column 2 */
+        { X, X, 0, X, X, 1, X, X, 2, X, X, 3, X, X, 4, X },
+        { X, 5, X, X, 6, X, X, 7, X, X, 8, X, X, 9, X, X },
+        { 10, X, X, 11, X, X, 12, X, X, 13, X, X, 14, X, X, 15 },
+    }
+};
+#undef X
+#endif
+
+/* Three columns interleaves three arrays, which needs a byte shuffle to do
+ * with vectors. */
+static void transpose_3(uint8_t *dest, const uint8_t *a, const uint8_t *b, const uint8_t *c, int height) {
+    int y = 0;
+#ifdef TRANSPOSE_SSSE3
+    for (; y + 16 <= height; y += 16, dest += 48) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + y));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + y));
+        __m128i vc = _mm_loadu_si128((const __m128i *)(c + y));
+        for (int i = 0; i < 3; i++) {
+            __m128i out = _mm_shuffle_epi8(va, _mm_loadu_si128((const __m128i *)shuffle_3[0][i]));
+            out = _mm_or_si128(out, _mm_shuffle_epi8(vb, _mm_loadu_si128((const __m128i *)shuffle_3[1][i])));
+            out = _mm_or_si128(out, _mm_shuffle_epi8(vc, _mm_loadu_si128((const __m128i *)shuffle_3[2][i])));
+            _mm_storeu_si128((__m128i *)(dest + 16 * i), out);
+        }
+    }
+#endif
+    for (; y < height; y++) {
+        *dest++ = a[y];
+        *dest++ = b[y];
+        *dest++ = c[y];
+    }
+}
+
+void transpose_glyph(uint8_t *dest, const uint8_t *source, int columns, int height) {
+    switch (columns) {
+        case 1:
+            memcpy(dest, source, height);
+            break;
+        case 2:
+            transpose_2(dest, source, source + height, height);
+            break;
+        case 3:
+            transpose_3(dest, source, source + height, source + 2 * height, height);
+            break;
+        default:
+            /* Not a secret message either. */
+            for (int c = 0; c < columns; c++)
+                for (int y = 0; y < height; y++)
+                    dest[y * columns + c] = *source++;
+            break;
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "convfont.h"
+
+/* Converts a glyph bitmap from FNT column-major order (each byte column stored
+ * top-to-bottom, one column after another) to the row-major order used by
+ * fontlib_bitmap_t.
+ * @param dest Receives height * columns bytes of row-major data.
+ * @param source height * columns bytes of column-major data.  Must not
+ * overlap dest.
+ * @param columns Number of byte columns, normally 1, 2, or 3.
+ * @param height Number of rows. */
+void transpose_glyph(uint8_t *dest, const uint8_t *source, int columns, int height);